@@ -0,0 +1,607 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host side of the XRP benchmark.
+ *
+ * Every measurement produces one CSV line, the first output line is the
+ * header. Latencies are per command, in microseconds, measured from the
+ * command submission to the return from xrp_run_command_sync/xrp_wait.
+ *
+ * Tests:
+ * - latency: one outstanding command, sync and async API, and async
+ *   with BENCH_BATCH commands in flight;
+ * - throughput: sync commands from 1..8 threads over 1..4 queues;
+ * - data: in_data/out_data size sweep across the inline data size;
+ * - buffers: buffer count sweep across the inline buffer count;
+ * - transfer: buffer size sweep for the buffer kinds:
+ *   device: buffer allocated by xrp_create_buffer;
+ *   host-pool: memory allocated by xrp_host_alloc;
+ *   host: memory allocated by malloc. With the native library it is
+ *         shared with the DSP when physically contiguous (always the case
+ *         for a single page) and copied otherwise.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "xrp_api.h"
+#include "bench_namespace.h"
+
+#define BENCH_MAX_QUEUES	4
+#define BENCH_MAX_THREADS	8
+#define BENCH_BATCH		16
+
+struct bench_params {
+	const char *test;
+	const char *mode;
+	unsigned queues;
+	unsigned threads;
+	size_t in_size;
+	size_t out_size;
+	unsigned buffers;
+	const char *kind;
+	size_t buffer_size;
+	unsigned iterations;
+};
+
+struct bench_command {
+	struct xrp_queue *queue;
+	const void *in_data;
+	size_t in_size;
+	void *out_data;
+	size_t out_size;
+	struct xrp_buffer_group *group;
+};
+
+static struct xrp_device *device;
+static struct xrp_queue *queue[BENCH_MAX_QUEUES];
+static unsigned iterations = 1000;
+
+static void check(enum xrp_status status, const char *what)
+{
+	if (status != XRP_STATUS_SUCCESS) {
+		fprintf(stderr, "%s failed\n", what);
+		exit(1);
+	}
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sample, unsigned n, unsigned p)
+{
+	return sample[(uint64_t)(n - 1) * p / 100] / 1000.;
+}
+
+static void report_header(void)
+{
+	printf("test,mode,queues,threads,in_size,out_size,buffers,"
+	       "buffer_kind,buffer_size,iterations,ops_per_s,mib_per_s,"
+	       "min_us,p50_us,p90_us,p99_us,max_us\n");
+}
+
+/*
+ * Print the result line. sample is sorted in place, elapsed is the wall
+ * time of the whole run and bytes is the amount of buffer data per
+ * command.
+ */
+static void report(const struct bench_params *params,
+		   uint64_t *sample, unsigned n, uint64_t elapsed,
+		   size_t bytes)
+{
+	double seconds = elapsed / 1e9;
+
+	qsort(sample, n, sizeof(*sample), cmp_u64);
+	printf("%s,%s,%u,%u,%zu,%zu,%u,%s,%zu,%u,%.1f,%.2f,"
+	       "%.2f,%.2f,%.2f,%.2f,%.2f\n",
+	       params->test, params->mode, params->queues, params->threads,
+	       params->in_size, params->out_size, params->buffers,
+	       params->kind ? params->kind : "none", params->buffer_size, n,
+	       n / seconds, (double)bytes * n / seconds / (1024 * 1024),
+	       sample[0] / 1000., percentile_us(sample, n, 50),
+	       percentile_us(sample, n, 90), percentile_us(sample, n, 99),
+	       sample[n - 1] / 1000.);
+	fflush(stdout);
+}
+
+static void run_sync(const struct bench_command *cmd,
+		     uint64_t *sample, unsigned n)
+{
+	enum xrp_status status = XRP_STATUS_FAILURE;
+	unsigned i;
+
+	for (i = 0; i < n; ++i) {
+		uint64_t t = now_ns();
+
+		xrp_run_command_sync(cmd->queue,
+				     cmd->in_data, cmd->in_size,
+				     cmd->out_data, cmd->out_size,
+				     cmd->group, &status);
+		sample[i] = now_ns() - t;
+		check(status, "xrp_run_command_sync");
+	}
+}
+
+/*
+ * Keep up to depth commands in flight, wait for them in order.
+ */
+static void run_async(const struct bench_command *cmd,
+		      uint64_t *sample, unsigned n, unsigned depth)
+{
+	struct xrp_event *event[BENCH_BATCH];
+	uint64_t start[BENCH_BATCH];
+	enum xrp_status status = XRP_STATUS_FAILURE;
+	unsigned submitted = 0;
+	unsigned completed;
+
+	for (completed = 0; completed < n; ++completed) {
+		unsigned slot;
+
+		while (submitted < n && submitted < completed + depth) {
+			slot = submitted % BENCH_BATCH;
+			start[slot] = now_ns();
+			xrp_enqueue_command(cmd->queue,
+					    cmd->in_data, cmd->in_size,
+					    cmd->out_data, cmd->out_size,
+					    cmd->group, event + slot, &status);
+			check(status, "xrp_enqueue_command");
+			++submitted;
+		}
+		slot = completed % BENCH_BATCH;
+		xrp_wait(event[slot], &status);
+		sample[completed] = now_ns() - start[slot];
+		check(status, "xrp_wait");
+		xrp_release_event(event[slot], &status);
+		check(status, "xrp_release_event");
+	}
+}
+
+static uint64_t *alloc_samples(unsigned n)
+{
+	uint64_t *sample = malloc(n * sizeof(*sample));
+
+	if (!sample) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	return sample;
+}
+
+static void bench_latency(void)
+{
+	static const struct {
+		const char *mode;
+		unsigned depth;
+	} mode[] = {
+		{ "sync", 0 },
+		{ "async", 1 },
+		{ "async-batch", BENCH_BATCH },
+	};
+	struct bench_command cmd = {
+		.queue = queue[0],
+	};
+	uint64_t *sample = alloc_samples(iterations);
+	unsigned i;
+
+	for (i = 0; i < sizeof(mode) / sizeof(mode[0]); ++i) {
+		struct bench_params params = {
+			.test = "latency",
+			.mode = mode[i].mode,
+			.queues = 1,
+			.threads = 1,
+			.iterations = iterations,
+		};
+		uint64_t t = now_ns();
+
+		if (mode[i].depth)
+			run_async(&cmd, sample, iterations, mode[i].depth);
+		else
+			run_sync(&cmd, sample, iterations);
+		report(&params, sample, iterations, now_ns() - t, 0);
+	}
+	free(sample);
+}
+
+struct bench_thread {
+	pthread_t thread;
+	struct bench_command cmd;
+	uint64_t *sample;
+};
+
+static void *bench_thread_fn(void *p)
+{
+	struct bench_thread *thread = p;
+
+	run_sync(&thread->cmd, thread->sample, iterations);
+	return NULL;
+}
+
+static void bench_throughput(void)
+{
+	static const unsigned n_queues[] = {1, 2, 4};
+	static const unsigned n_threads[] = {1, 2, 4, 8};
+	struct bench_thread thread[BENCH_MAX_THREADS];
+	uint64_t *sample = alloc_samples(iterations * BENCH_MAX_THREADS);
+	unsigned q, t, i;
+
+	for (q = 0; q < sizeof(n_queues) / sizeof(n_queues[0]); ++q) {
+		for (t = 0; t < sizeof(n_threads) / sizeof(n_threads[0]); ++t) {
+			struct bench_params params = {
+				.test = "throughput",
+				.mode = "sync",
+				.queues = n_queues[q],
+				.threads = n_threads[t],
+				.iterations = iterations,
+			};
+			uint64_t start;
+
+			if (n_threads[t] < n_queues[q])
+				continue;
+
+			start = now_ns();
+			for (i = 0; i < n_threads[t]; ++i) {
+				thread[i] = (struct bench_thread){
+					.cmd.queue = queue[i % n_queues[q]],
+					.sample = sample + i * iterations,
+				};
+				if (pthread_create(&thread[i].thread, NULL,
+						   bench_thread_fn,
+						   thread + i)) {
+					perror("pthread_create");
+					exit(1);
+				}
+			}
+			for (i = 0; i < n_threads[t]; ++i)
+				pthread_join(thread[i].thread, NULL);
+			report(&params, sample, iterations * n_threads[t],
+			       now_ns() - start, 0);
+		}
+	}
+	free(sample);
+}
+
+static void bench_data(void)
+{
+	static const size_t size[] = {
+		0, 4, 8, 12, 15, 16, 17, 20, 24, 32, 64, 256, 1024, 4096,
+	};
+	uint8_t *in_data = calloc(1, size[sizeof(size) / sizeof(size[0]) - 1]);
+	uint8_t *out_data = calloc(1, size[sizeof(size) / sizeof(size[0]) - 1]);
+	uint64_t *sample = alloc_samples(iterations);
+	unsigned i;
+
+	if (!in_data || !out_data) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < sizeof(size) / sizeof(size[0]); ++i) {
+		struct bench_params params = {
+			.test = "data",
+			.mode = "sync",
+			.queues = 1,
+			.threads = 1,
+			.in_size = size[i],
+			.out_size = size[i],
+			.iterations = iterations,
+		};
+		struct bench_command cmd = {
+			.queue = queue[0],
+			.in_data = in_data,
+			.in_size = size[i],
+			.out_data = out_data,
+			.out_size = size[i],
+		};
+		uint64_t t = now_ns();
+
+		run_sync(&cmd, sample, iterations);
+		report(&params, sample, iterations, now_ns() - t, 0);
+	}
+	free(sample);
+	free(out_data);
+	free(in_data);
+}
+
+enum bench_kind {
+	BENCH_KIND_DEVICE,
+	BENCH_KIND_HOST_POOL,
+	BENCH_KIND_HOST,
+};
+
+static const char * const bench_kind_name[] = {
+	[BENCH_KIND_DEVICE] = "device",
+	[BENCH_KIND_HOST_POOL] = "host-pool",
+	[BENCH_KIND_HOST] = "host",
+};
+
+struct bench_group {
+	struct xrp_buffer_group *group;
+	struct xrp_buffer *buffer[16];
+	void *host_ptr[16];
+	unsigned n;
+	enum bench_kind kind;
+};
+
+static void bench_group_create(struct bench_group *bg, enum bench_kind kind,
+			       unsigned n, size_t size)
+{
+	enum xrp_status status = XRP_STATUS_FAILURE;
+	unsigned i;
+
+	bg->group = xrp_create_buffer_group(&status);
+	check(status, "xrp_create_buffer_group");
+	bg->n = n;
+	bg->kind = kind;
+
+	for (i = 0; i < n; ++i) {
+		void *p = NULL;
+
+		switch (kind) {
+		case BENCH_KIND_DEVICE:
+			break;
+		case BENCH_KIND_HOST_POOL:
+			p = xrp_host_alloc(device, size, &status);
+			check(status, "xrp_host_alloc");
+			break;
+		case BENCH_KIND_HOST:
+			if (posix_memalign(&p, 4096, size)) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+			break;
+		}
+		if (p)
+			memset(p, 0, size);
+		bg->host_ptr[i] = p;
+		bg->buffer[i] = xrp_create_buffer(device, size, p, &status);
+		check(status, "xrp_create_buffer");
+		xrp_add_buffer_to_group(bg->group, bg->buffer[i],
+					XRP_READ_WRITE, &status);
+		check(status, "xrp_add_buffer_to_group");
+	}
+}
+
+static void bench_group_release(struct bench_group *bg)
+{
+	enum xrp_status status = XRP_STATUS_FAILURE;
+	unsigned i;
+
+	xrp_release_buffer_group(bg->group, &status);
+	check(status, "xrp_release_buffer_group");
+	for (i = 0; i < bg->n; ++i) {
+		xrp_release_buffer(bg->buffer[i], &status);
+		check(status, "xrp_release_buffer");
+		switch (bg->kind) {
+		case BENCH_KIND_DEVICE:
+			break;
+		case BENCH_KIND_HOST_POOL:
+			xrp_host_free(device, bg->host_ptr[i], &status);
+			check(status, "xrp_host_free");
+			break;
+		case BENCH_KIND_HOST:
+			free(bg->host_ptr[i]);
+			break;
+		}
+	}
+}
+
+/*
+ * Buffer count sweep. The DSP touches one word of every buffer.
+ * Up to XRP_DSP_CMD_INLINE_BUFFER_COUNT buffer descriptors fit into the
+ * command, more are passed in a separate allocation.
+ */
+static void bench_buffers(void)
+{
+	static const unsigned count[] = {0, 1, 2, 3, 4, 8, 16};
+	struct bench_cmd cmd_data = {
+		.cmd = BENCH_CMD_TOUCH,
+		.arg = 64,
+	};
+	uint64_t *sample = alloc_samples(iterations);
+	unsigned i;
+
+	for (i = 0; i < sizeof(count) / sizeof(count[0]); ++i) {
+		struct bench_params params = {
+			.test = "buffers",
+			.mode = "sync",
+			.queues = 1,
+			.threads = 1,
+			.in_size = sizeof(cmd_data),
+			.buffers = count[i],
+			.kind = bench_kind_name[BENCH_KIND_DEVICE],
+			.buffer_size = 64,
+			.iterations = iterations,
+		};
+		struct bench_group bg;
+		struct bench_command cmd = {
+			.queue = queue[0],
+			.in_data = &cmd_data,
+			.in_size = sizeof(cmd_data),
+		};
+		uint64_t t;
+
+		bench_group_create(&bg, BENCH_KIND_DEVICE, count[i], 64);
+		cmd.group = bg.group;
+		t = now_ns();
+		run_sync(&cmd, sample, iterations);
+		report(&params, sample, iterations, now_ns() - t,
+		       64 * count[i]);
+		bench_group_release(&bg);
+	}
+	free(sample);
+}
+
+/*
+ * Buffer size sweep for each buffer kind. The DSP touches one word of
+ * every page of the buffer.
+ */
+static void bench_transfer(void)
+{
+	static const size_t size[] = {
+		256, 4096, 16384, 65536, 262144, 1048576,
+	};
+	struct bench_cmd cmd_data = {
+		.cmd = BENCH_CMD_TOUCH,
+		.arg = 4096,
+	};
+	uint64_t *sample = alloc_samples(iterations);
+	unsigned i, k;
+
+	for (k = 0; k < sizeof(bench_kind_name) / sizeof(bench_kind_name[0]); ++k) {
+		for (i = 0; i < sizeof(size) / sizeof(size[0]); ++i) {
+			unsigned n = iterations / (1 + size[i] / 65536);
+			struct bench_params params = {
+				.test = "transfer",
+				.mode = "sync",
+				.queues = 1,
+				.threads = 1,
+				.in_size = sizeof(cmd_data),
+				.buffers = 1,
+				.kind = bench_kind_name[k],
+				.buffer_size = size[i],
+			};
+			struct bench_group bg;
+			struct bench_command cmd = {
+				.queue = queue[0],
+				.in_data = &cmd_data,
+				.in_size = sizeof(cmd_data),
+			};
+			uint64_t t;
+
+			if (!n)
+				n = 1;
+			params.iterations = n;
+			bench_group_create(&bg, k, 1, size[i]);
+			cmd.group = bg.group;
+			t = now_ns();
+			run_sync(&cmd, sample, n);
+			report(&params, sample, n, now_ns() - t, size[i]);
+			bench_group_release(&bg);
+		}
+	}
+	free(sample);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} bench_test[] = {
+	{ "latency", bench_latency },
+	{ "throughput", bench_throughput },
+	{ "data", bench_data },
+	{ "buffers", bench_buffers },
+	{ "transfer", bench_transfer },
+};
+
+static void usage(const char *name)
+{
+	unsigned i;
+
+	fprintf(stderr,
+		"Usage: %s [-d device] [-n iterations] [-t test[,test...]]\n"
+		"Tests:", name);
+	for (i = 0; i < sizeof(bench_test) / sizeof(bench_test[0]); ++i)
+		fprintf(stderr, " %s", bench_test[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	enum xrp_status status = XRP_STATUS_FAILURE;
+	const char *tests = NULL;
+	int devid = 0;
+	unsigned i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:t:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			devid = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			tests = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!iterations) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	device = xrp_open_device(devid, &status);
+	check(status, "xrp_open_device");
+	for (i = 0; i < BENCH_MAX_QUEUES; ++i) {
+		queue[i] = xrp_create_ns_queue(device, XRP_BENCH_NSID, &status);
+		check(status, "xrp_create_ns_queue");
+	}
+
+	report_header();
+	for (i = 0; i < sizeof(bench_test) / sizeof(bench_test[0]); ++i) {
+		size_t len = strlen(bench_test[i].name);
+		const char *p = tests;
+
+		while (p) {
+			if (!strncmp(p, bench_test[i].name, len) &&
+			    (p[len] == ',' || p[len] == 0))
+				break;
+			p = strchr(p, ',');
+			if (p)
+				++p;
+		}
+		if (!tests || p)
+			bench_test[i].fn();
+	}
+
+	for (i = 0; i < BENCH_MAX_QUEUES; ++i) {
+		xrp_release_queue(queue[i], &status);
+		check(status, "xrp_release_queue");
+	}
+	xrp_release_device(device, &status);
+	check(status, "xrp_release_device");
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _BENCH_NAMESPACE_H
+#define _BENCH_NAMESPACE_H
+
+#include <stdint.h>
+
+#define XRP_BENCH_NSID_INITIALIZER \
+	{0x6b, 0x1e, 0x3f, 0x0a, 0x52, 0x9d, 0x4c, 0x81, \
+	 0x9e, 0x27, 0xd4, 0x40, 0x5c, 0x13, 0xa8, 0x7f}
+#define XRP_BENCH_NSID (unsigned char [])XRP_BENCH_NSID_INITIALIZER
+
+/*
+ * Commands of the benchmark namespace. in_data shorter than struct
+ * bench_cmd is an echo command, so that sizes below the header size can
+ * be measured too.
+ *
+ * BENCH_CMD_ECHO: copy in_data to out_data, as much as fits.
+ * BENCH_CMD_COMPUTE: echo, then spin for arg iterations.
+ * BENCH_CMD_TOUCH: echo, then map every buffer of the group, read one
+ *                  word of every arg bytes of it and write it back
+ *                  incremented. arg of 0 means 4096.
+ */
+enum {
+	BENCH_CMD_ECHO,
+	BENCH_CMD_COMPUTE,
+	BENCH_CMD_TOUCH,
+};
+
+struct bench_cmd {
+	uint32_t cmd;
+	uint32_t arg;
+};
+
+#endif
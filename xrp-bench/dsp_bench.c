@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * DSP side of the XRP benchmark: a firmware that serves the benchmark
+ * namespace only.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "xrp_api.h"
+#include "xrp_dsp_hw.h"
+#include "bench_namespace.h"
+
+static void bench_touch(struct xrp_buffer_group *buffer_group,
+			uint32_t stride)
+{
+	size_t n_buffers = 0;
+	size_t i;
+
+	if (!stride)
+		stride = 4096;
+	xrp_buffer_group_get_info(buffer_group, XRP_BUFFER_GROUP_SIZE_SIZE_T,
+				  0, &n_buffers, sizeof(n_buffers), NULL);
+
+	for (i = 0; i < n_buffers; ++i) {
+		struct xrp_buffer *buffer =
+			xrp_get_buffer_from_group(buffer_group, i, NULL);
+		enum xrp_status status = XRP_STATUS_FAILURE;
+		size_t sz = 0;
+		size_t off;
+		uint8_t *p;
+
+		if (!buffer)
+			break;
+		xrp_buffer_get_info(buffer, XRP_BUFFER_SIZE_SIZE_T,
+				    &sz, sizeof(sz), NULL);
+		p = xrp_map_buffer(buffer, 0, sz, XRP_READ_WRITE, &status);
+		if (status == XRP_STATUS_SUCCESS) {
+			for (off = 0; off + sizeof(uint32_t) <= sz;
+			     off += stride) {
+				uint32_t v;
+
+				memcpy(&v, p + off, sizeof(v));
+				++v;
+				memcpy(p + off, &v, sizeof(v));
+			}
+			xrp_unmap_buffer(buffer, p, NULL);
+		}
+		xrp_release_buffer(buffer, NULL);
+	}
+}
+
+static enum xrp_status bench_handler(void *handler_context,
+				     const void *in_data, size_t in_data_size,
+				     void *out_data, size_t out_data_size,
+				     struct xrp_buffer_group *buffer_group)
+{
+	struct bench_cmd cmd = {
+		.cmd = BENCH_CMD_ECHO,
+	};
+	volatile uint32_t i;
+
+	(void)handler_context;
+	if (in_data_size && out_data_size)
+		memcpy(out_data, in_data, in_data_size < out_data_size ?
+		       in_data_size : out_data_size);
+
+	if (in_data_size >= sizeof(cmd))
+		memcpy(&cmd, in_data, sizeof(cmd));
+
+	switch (cmd.cmd) {
+	case BENCH_CMD_ECHO:
+		break;
+	case BENCH_CMD_COMPUTE:
+		for (i = 0; i < cmd.arg; ++i)
+			;
+		break;
+	case BENCH_CMD_TOUCH:
+		bench_touch(buffer_group, cmd.arg);
+		break;
+	default:
+		return XRP_STATUS_FAILURE;
+	}
+	return XRP_STATUS_SUCCESS;
+}
+
+int main(void)
+{
+	enum xrp_status status;
+	struct xrp_device *device;
+
+	device = xrp_open_device(0, &status);
+	if (status != XRP_STATUS_SUCCESS) {
+		printf("xrp_open_device failed\n");
+		return 1;
+	}
+	xrp_device_register_namespace(device, XRP_BENCH_NSID,
+				      bench_handler, NULL, &status);
+	if (status != XRP_STATUS_SUCCESS) {
+		printf("xrp_register_namespace for XRP_BENCH_NSID failed\n");
+		return 1;
+	}
+	for (;;) {
+		status = xrp_device_dispatch(device);
+		if (status == XRP_STATUS_PENDING)
+			xrp_hw_wait_device_irq();
+	}
+	return 0;
+}
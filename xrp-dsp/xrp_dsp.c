@@ -25,8 +25,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef XRP_DSP_HOST
+#include "xrp_dsp_host.h"
+#else
+#include <xtensa/config/core.h>
 #include <xtensa/tie/xt_sync.h>
 #include <xtensa/xtruntime.h>
+#endif
 
 #include "xrp_api.h"
 #include "xrp_dsp_hw.h"
@@ -48,9 +53,22 @@ static inline int pr_debug(const char *p, ...)
 extern char xrp_dsp_comm_base_magic[] __attribute__((weak));
 void *xrp_dsp_comm_base = &xrp_dsp_comm_base_magic;
 
+#ifdef XRP_DSP_HOST
+#define p2v(addr) xrp_hw_p2v(addr)
+#else
+#define p2v(addr) ((void *)(addr))
+#endif
+
 static int manage_cache;
 
 #define MAX_STACK_BUFFERS 16
+#define MAX_BUFFER_RANGES 4
+
+#if defined(XCHAL_DCACHE_LINESIZE) && XCHAL_DCACHE_LINESIZE > 0
+#define DCACHE_LINESIZE XCHAL_DCACHE_LINESIZE
+#else
+#define DCACHE_LINESIZE 1
+#endif
 
 /* DSP side XRP API implementation */
 
@@ -64,12 +82,16 @@ struct xrp_cmd_ns {
 	void *handler_context;
 };
 
-struct xrp_device {
-	struct xrp_refcounted ref;
-	void *dsp_cmd;
-	size_t n_cmd_ns;
-	size_t size_cmd_ns;
-	struct xrp_cmd_ns *cmd_ns;
+/*
+ * Sorted set of disjoint [start, end) ranges. There's room for one extra
+ * range that is merged with its closest neighbour on insertion.
+ */
+struct xrp_range_set {
+	uint32_t n;
+	struct {
+		uint32_t start;
+		uint32_t end;
+	} range[MAX_BUFFER_RANGES + 1];
 };
 
 struct xrp_buffer {
@@ -79,6 +101,17 @@ struct xrp_buffer {
 	unsigned long map_count;
 	enum xrp_access_flags allowed_access;
 	enum xrp_access_flags map_flags;
+
+	/*
+	 * Cache lines that lie entirely within the buffer are invalidated
+	 * when they are mapped. valid tracks invalidated ranges relative
+	 * to cache_base, dirty tracks ranges mapped for writing relative
+	 * to ptr.
+	 */
+	void *cache_base;
+	size_t cache_size;
+	struct xrp_range_set valid;
+	struct xrp_range_set dirty;
 };
 
 struct xrp_buffer_group {
@@ -87,6 +120,35 @@ struct xrp_buffer_group {
 	struct xrp_buffer *buffer;
 };
 
+/*
+ * State of the command being processed. It outlives the handler call when
+ * the handler defers the command completion.
+ */
+struct xrp_command_token {
+	struct xrp_dsp_cmd *dsp_cmd;
+	uint32_t flags;
+	int deferred;
+	size_t n_buffers;
+	struct xrp_dsp_buffer *dsp_buffer;
+	struct xrp_buffer_group buffer_group;
+	struct xrp_buffer *buffer;
+	struct xrp_buffer sbuffer[MAX_STACK_BUFFERS];
+};
+
+struct xrp_device {
+	struct xrp_refcounted ref;
+	void *dsp_cmd;
+	size_t n_cmd_ns;
+	size_t size_cmd_ns;
+	struct xrp_cmd_ns *cmd_ns;
+	struct xrp_command_token cmd;
+};
+
+/*
+ * Command whose handler is currently running.
+ */
+static struct xrp_command_token *current_cmd;
+
 
 static inline void dcache_region_invalidate(void *p, size_t sz)
 {
@@ -100,6 +162,53 @@ static inline void dcache_region_writeback(void *p, size_t sz)
 		xthal_dcache_region_writeback(p, sz);
 }
 
+/*
+ * Add [start, end) to the set. When the set overflows the two closest
+ * ranges are merged and the gap between them is passed to fill_gap.
+ */
+static void range_set_add(struct xrp_range_set *set,
+			  uint32_t start, uint32_t end,
+			  void (*fill_gap)(void *p, size_t sz), void *base)
+{
+	uint32_t i, j, k;
+
+	for (i = 0; i < set->n && set->range[i].end < start; ++i)
+		;
+	for (j = i; j < set->n && set->range[j].start <= end; ++j) {
+		if (set->range[j].start < start)
+			start = set->range[j].start;
+		if (set->range[j].end > end)
+			end = set->range[j].end;
+	}
+	if (j == i) {
+		memmove(set->range + i + 1, set->range + i,
+			(set->n - i) * sizeof(set->range[0]));
+		++set->n;
+	} else {
+		memmove(set->range + i + 1, set->range + j,
+			(set->n - j) * sizeof(set->range[0]));
+		set->n -= j - i - 1;
+	}
+	set->range[i].start = start;
+	set->range[i].end = end;
+
+	if (set->n <= MAX_BUFFER_RANGES)
+		return;
+
+	for (i = 0, k = 1; k < set->n - 1; ++k)
+		if (set->range[k + 1].start - set->range[k].end <
+		    set->range[i + 1].start - set->range[i].end)
+			i = k;
+
+	if (fill_gap)
+		fill_gap((char *)base + set->range[i].end,
+			 set->range[i + 1].start - set->range[i].end);
+	set->range[i].end = set->range[i + 1].end;
+	memmove(set->range + i + 1, set->range + i + 2,
+		(set->n - i - 2) * sizeof(set->range[0]));
+	--set->n;
+}
+
 static inline void set_status(enum xrp_status *status, enum xrp_status v)
 {
 	if (status)
@@ -290,6 +399,17 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 	return NULL;
 }
 
+struct xrp_buffer *xrp_create_sub_buffer(struct xrp_buffer *parent,
+					 size_t offset, size_t size,
+					 enum xrp_status *status)
+{
+	(void)parent;
+	(void)offset;
+	(void)size;
+	set_status(status, XRP_STATUS_FAILURE);
+	return NULL;
+}
+
 void xrp_retain_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 {
 	set_status(status, retain_refcounted(&buffer->ref));
@@ -300,12 +420,115 @@ void xrp_release_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 	set_status(status, release_refcounted(&buffer->ref));
 }
 
+/*
+ * Invalidate cache lines in [start, end) of the buffer cache region that
+ * haven't been invalidated yet. Lines invalidated earlier may hold data
+ * written by the handler and must not be invalidated again.
+ */
+static void buffer_invalidate_range(struct xrp_buffer *buffer,
+				    uint32_t start, uint32_t end)
+{
+	char *base = buffer->cache_base;
+	uint32_t cur = start;
+	uint32_t i;
+
+	for (i = 0; i < buffer->valid.n && cur < end; ++i) {
+		if (buffer->valid.range[i].end <= cur)
+			continue;
+		if (buffer->valid.range[i].start >= end)
+			break;
+		if (buffer->valid.range[i].start > cur)
+			dcache_region_invalidate(base + cur,
+						 buffer->valid.range[i].start - cur);
+		cur = buffer->valid.range[i].end;
+	}
+	if (cur < end)
+		dcache_region_invalidate(base + cur, end - cur);
+	range_set_add(&buffer->valid, start, end,
+		      dcache_region_invalidate, base);
+}
+
+static void buffer_map_cache(struct xrp_buffer *buffer,
+			     size_t offset, size_t size,
+			     enum xrp_access_flags map_flags)
+{
+	uintptr_t base = (uintptr_t)buffer->cache_base;
+	uintptr_t start = (uintptr_t)buffer->ptr + offset;
+	uintptr_t end = start + size;
+
+	if (start < base)
+		start = base;
+	if (end > base + buffer->cache_size)
+		end = base + buffer->cache_size;
+	if (start < end) {
+		start &= -(uintptr_t)DCACHE_LINESIZE;
+		end = (end + DCACHE_LINESIZE - 1) & -(uintptr_t)DCACHE_LINESIZE;
+		buffer_invalidate_range(buffer, start - base, end - base);
+	}
+	if (map_flags & XRP_WRITE)
+		range_set_add(&buffer->dirty, offset, offset + size,
+			      NULL, NULL);
+}
+
+/*
+ * Invalidate partial cache lines at the buffer edges now, as they may be
+ * shared with other buffers that the handler writes to. Lines entirely
+ * within the buffer are invalidated lazily, when they are mapped.
+ * Buffers that overlap other buffers are invalidated entirely.
+ */
+static void buffer_init_cache(struct xrp_buffer *buffer, int lazy)
+{
+	uintptr_t start = (uintptr_t)buffer->ptr;
+	uintptr_t end = start + buffer->size;
+	uintptr_t base = (start + DCACHE_LINESIZE - 1) &
+		-(uintptr_t)DCACHE_LINESIZE;
+	uintptr_t cache_end = end & -(uintptr_t)DCACHE_LINESIZE;
+
+	if (!lazy || cache_end <= base) {
+		dcache_region_invalidate(buffer->ptr, buffer->size);
+		return;
+	}
+	if (base > start)
+		dcache_region_invalidate(buffer->ptr, base - start);
+	if (end > cache_end)
+		dcache_region_invalidate((void *)cache_end, end - cache_end);
+	buffer->cache_base = (void *)base;
+	buffer->cache_size = cache_end - base;
+}
+
+static void buffer_writeback_cache(struct xrp_buffer *buffer)
+{
+	uint32_t i;
+
+	for (i = 0; i < buffer->dirty.n; ++i)
+		dcache_region_writeback((char *)buffer->ptr +
+					buffer->dirty.range[i].start,
+					buffer->dirty.range[i].end -
+					buffer->dirty.range[i].start);
+}
+
+static int buffer_overlaps(const struct xrp_buffer *buffer,
+			   size_t n_buffers, size_t idx)
+{
+	const char *p = buffer[idx].ptr;
+	size_t i;
+
+	for (i = 0; i < n_buffers; ++i)
+		if (i != idx &&
+		    p < (char *)buffer[i].ptr + buffer[i].size &&
+		    (char *)buffer[i].ptr < p + buffer[idx].size)
+			return 1;
+	return 0;
+}
+
 void *xrp_map_buffer(struct xrp_buffer *buffer, size_t offset, size_t size,
 		     enum xrp_access_flags map_flags, enum xrp_status *status)
 {
 	if (offset <= buffer->size &&
 	    size <= buffer->size - offset &&
 	    (buffer->allowed_access & map_flags) == map_flags) {
+		if (manage_cache && size)
+			buffer_map_cache(buffer, offset, size, map_flags);
 		retain_refcounted(&buffer->ref);
 		++buffer->map_count;
 		buffer->map_flags |= map_flags;
@@ -435,6 +658,13 @@ out:
 	set_status(status, s);
 }
 
+void xrp_seal_buffer_group(struct xrp_buffer_group *group,
+			   enum xrp_status *status)
+{
+	(void)group;
+	set_status(status, XRP_STATUS_SUCCESS);
+}
+
 /* DSP side request handling */
 
 static void do_handshake(struct xrp_dsp_sync *shared_sync)
@@ -538,6 +768,63 @@ xrp_run_command_handler(void *handler_context,
 	return status;
 }
 
+static void finish_command(struct xrp_command_token *cmd,
+			   enum xrp_status status)
+{
+	struct xrp_dsp_cmd *dsp_cmd = cmd->dsp_cmd;
+	struct xrp_buffer *buffer = cmd->buffer;
+	size_t n_buffers = cmd->n_buffers;
+	uint32_t flags = cmd->flags;
+	size_t i;
+
+	if (status != XRP_STATUS_SUCCESS)
+		flags |= XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL;
+
+	/*
+	 * update flags in the buffer data: what access actually took place,
+	 * to update caches on the host side.
+	 */
+	for (i = 0; i < n_buffers; ++i) {
+		__u32 flags = 0;
+
+		if (buffer[i].map_flags & XRP_READ)
+			flags |= XRP_DSP_BUFFER_FLAG_READ;
+		if (buffer[i].map_flags & XRP_WRITE)
+			flags |= XRP_DSP_BUFFER_FLAG_WRITE;
+
+		pr_debug("%s: dsp_buffer[%d].flags = %d\n", __func__, i, flags);
+		cmd->dsp_buffer[i].flags = flags;
+
+		if (buffer[i].ref.count) {
+			pr_debug("%s: refcount leak on buffer %d\n",
+				__func__, i);
+		}
+		if (buffer[i].map_count) {
+			pr_debug("%s: map_count leak on buffer %d\n",
+				__func__, i);
+		}
+		if (buffer[i].map_flags & XRP_WRITE) {
+			buffer_writeback_cache(buffer + i);
+		}
+	}
+	if (cmd->buffer_group.ref.count) {
+		pr_debug("%s: refcount leak on buffer group\n", __func__);
+	}
+	if (dsp_cmd->out_data_size > sizeof(dsp_cmd->out_data)) {
+		dcache_region_writeback(p2v(dsp_cmd->out_data_addr),
+					dsp_cmd->out_data_size);
+	}
+	if (n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
+		dcache_region_writeback(cmd->dsp_buffer,
+					n_buffers * sizeof(*cmd->dsp_buffer));
+	}
+	if (n_buffers > MAX_STACK_BUFFERS) {
+		free(buffer);
+	}
+	cmd->deferred = 0;
+	complete_request(dsp_cmd, flags);
+}
+
 static enum xrp_status process_command(struct xrp_device *device,
 				       uint32_t flags)
 {
@@ -545,9 +832,8 @@ static enum xrp_status process_command(struct xrp_device *device,
 	struct xrp_dsp_cmd *dsp_cmd = device->dsp_cmd;
 	size_t n_buffers = dsp_cmd->buffer_size / sizeof(struct xrp_dsp_buffer);
 	struct xrp_dsp_buffer *dsp_buffer;
-	struct xrp_buffer_group buffer_group;
-	struct xrp_buffer sbuffer[n_buffers <= MAX_STACK_BUFFERS ? n_buffers : 1];
-	struct xrp_buffer *buffer = sbuffer;
+	struct xrp_command_token *cmd = &device->cmd;
+	struct xrp_buffer *buffer = cmd->sbuffer;
 	xrp_command_handler *command_handler = xrp_run_command_handler;
 	void *handler_context = NULL;
 	size_t i;
@@ -565,7 +851,7 @@ static enum xrp_status process_command(struct xrp_device *device,
 	}
 
 	if (n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
-		dsp_buffer = (void *)dsp_cmd->buffer_addr;
+		dsp_buffer = p2v(dsp_cmd->buffer_addr);
 		dcache_region_invalidate(dsp_buffer,
 					 n_buffers * sizeof(*dsp_buffer));
 
@@ -573,7 +859,7 @@ static enum xrp_status process_command(struct xrp_device *device,
 		dsp_buffer = (void *)&dsp_cmd->buffer_data;
 	}
 	if (dsp_cmd->in_data_size > sizeof(dsp_cmd->in_data)) {
-		dcache_region_invalidate((void *)dsp_cmd->in_data_addr,
+		dcache_region_invalidate(p2v(dsp_cmd->in_data_addr),
 					 dsp_cmd->in_data_size);
 	}
 	if (n_buffers > MAX_STACK_BUFFERS) {
@@ -596,79 +882,83 @@ static enum xrp_status process_command(struct xrp_device *device,
 		buffer[i] = (struct xrp_buffer){
 			.allowed_access =
 				dsp_buffer_allowed_access(dsp_buffer[i].flags),
-			.ptr = (void *)dsp_buffer[i].addr,
+			.ptr = p2v(dsp_buffer[i].addr),
 			.size = dsp_buffer[i].size,
 		};
-		if (buffer[i].allowed_access & XRP_READ) {
-			dcache_region_invalidate(buffer[i].ptr,
-						 buffer[i].size);
+	}
+	/*
+	 * Checking for overlaps is quadratic, only do it for small groups,
+	 * buffers of large groups are invalidated in full.
+	 */
+	if (manage_cache) {
+		for (i = 0; i < n_buffers; ++i) {
+			if (buffer[i].allowed_access & XRP_READ)
+				buffer_init_cache(buffer + i,
+						  n_buffers <= MAX_STACK_BUFFERS &&
+						  !buffer_overlaps(buffer,
+								   n_buffers, i));
 		}
 	}
 
-	buffer_group = (struct xrp_buffer_group){
+	cmd->dsp_cmd = dsp_cmd;
+	cmd->flags = flags;
+	cmd->deferred = 0;
+	cmd->n_buffers = n_buffers;
+	cmd->dsp_buffer = dsp_buffer;
+	cmd->buffer = buffer;
+	cmd->buffer_group = (struct xrp_buffer_group){
 		.n_buffers = n_buffers,
 		.buffer = buffer,
 	};
 
+	current_cmd = cmd;
 	status = command_handler(handler_context,
 				 dsp_cmd->in_data_size > sizeof(dsp_cmd->in_data) ?
-				 (void *)dsp_cmd->in_data_addr : dsp_cmd->in_data,
+				 p2v(dsp_cmd->in_data_addr) : dsp_cmd->in_data,
 				 dsp_cmd->in_data_size,
 				 dsp_cmd->out_data_size > sizeof(dsp_cmd->out_data) ?
-				 (void *)dsp_cmd->out_data_addr : dsp_cmd->out_data,
+				 p2v(dsp_cmd->out_data_addr) : dsp_cmd->out_data,
 				 dsp_cmd->out_data_size,
-				 &buffer_group);
-
-	if (status != XRP_STATUS_SUCCESS)
-		flags |= XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL;
+				 &cmd->buffer_group);
+	current_cmd = NULL;
 
 	/*
-	 * update flags in the buffer data: what access actually took place,
-	 * to update caches on the host side.
+	 * The handler has successfully started the command, it will be
+	 * completed by xrp_complete_command.
 	 */
-	for (i = 0; i < n_buffers; ++i) {
-		__u32 flags = 0;
-
-		if (buffer[i].map_flags & XRP_READ)
-			flags |= XRP_DSP_BUFFER_FLAG_READ;
-		if (buffer[i].map_flags & XRP_WRITE)
-			flags |= XRP_DSP_BUFFER_FLAG_WRITE;
-
-		pr_debug("%s: dsp_buffer[%d].flags = %d\n", __func__, i, flags);
-		dsp_buffer[i].flags = flags;
+	if (status == XRP_STATUS_PENDING && cmd->deferred)
+		return XRP_STATUS_SUCCESS;
 
-		if (buffer[i].ref.count) {
-			pr_debug("%s: refcount leak on buffer %d\n",
-				__func__, i);
-		}
-		if (buffer[i].map_count) {
-			pr_debug("%s: map_count leak on buffer %d\n",
-				__func__, i);
-		}
-		if (buffer[i].map_flags & XRP_WRITE) {
-			dcache_region_writeback(buffer[i].ptr,
-						buffer[i].size);
-		}
-	}
-	if (buffer_group.ref.count) {
-		pr_debug("%s: refcount leak on buffer group\n", __func__);
-	}
-	if (dsp_cmd->out_data_size > sizeof(dsp_cmd->out_data)) {
-		dcache_region_writeback((void *)dsp_cmd->out_data_addr,
-					dsp_cmd->out_data_size);
-	}
-	if (n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
-		dcache_region_writeback(dsp_buffer,
-					n_buffers * sizeof(*dsp_buffer));
-	}
-	if (n_buffers > MAX_STACK_BUFFERS) {
-		free(buffer);
-	}
+	finish_command(cmd, status);
+	return status;
 out:
 	complete_request(dsp_cmd, flags);
 	return status;
 }
 
+struct xrp_command_token *xrp_defer_command(enum xrp_status *status)
+{
+	if (current_cmd) {
+		current_cmd->deferred = 1;
+		set_status(status, XRP_STATUS_SUCCESS);
+		return current_cmd;
+	}
+	set_status(status, XRP_STATUS_FAILURE);
+	return NULL;
+}
+
+void xrp_complete_command(struct xrp_command_token *token,
+			  enum xrp_status command_status,
+			  enum xrp_status *status)
+{
+	if (token && token->deferred && token != current_cmd) {
+		finish_command(token, command_status);
+		set_status(status, XRP_STATUS_SUCCESS);
+	} else {
+		set_status(status, XRP_STATUS_FAILURE);
+	}
+}
+
 void xrp_device_register_namespace(struct xrp_device *device,
 				   const void *nsid,
 				   xrp_command_handler *handler,
@@ -712,6 +1002,13 @@ enum xrp_status xrp_device_poll(struct xrp_device *device)
 {
 	uint32_t flags;
 
+	/*
+	 * The only command slot is busy until the deferred command
+	 * is completed.
+	 */
+	if (device->cmd.deferred)
+		return XRP_STATUS_PENDING;
+
 	dcache_region_invalidate(device->dsp_cmd,
 				 sizeof(*device->dsp_cmd));
 	if (xrp_request_valid(device->dsp_cmd, &flags))
@@ -725,6 +1022,9 @@ enum xrp_status xrp_device_dispatch(struct xrp_device *device)
 	uint32_t flags;
 	enum xrp_status status;
 
+	if (device->cmd.deferred)
+		return XRP_STATUS_PENDING;
+
 	dcache_region_invalidate(device->dsp_cmd,
 				 sizeof(*device->dsp_cmd));
 	if (!xrp_request_valid(device->dsp_cmd, &flags))
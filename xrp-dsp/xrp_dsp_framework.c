@@ -23,8 +23,10 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#ifndef XRP_DSP_HOST
 #include <xtensa/tie/xt_sync.h>
 #include <xtensa/xtruntime.h>
+#endif
 
 #include "xrp_api.h"
 #include "xrp_dsp_hw.h"
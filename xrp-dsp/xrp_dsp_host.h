@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XRP_DSP_HOST_H
+#define XRP_DSP_HOST_H
+
+/*
+ * Replacements for the Xtensa intrinsics and HAL calls used by the DSP
+ * library when it's built to run as a host process.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define XT_L32AI(p, off) \
+	__atomic_load_n((uint32_t *)((char *)(p) + (off)), __ATOMIC_ACQUIRE)
+#define XT_S32RI(v, p, off) \
+	__atomic_store_n((uint32_t *)((char *)(p) + (off)), (v), \
+			 __ATOMIC_RELEASE)
+
+/*
+ * Host memory shared with the host side is coherent.
+ */
+static inline void xthal_dcache_region_invalidate(void *p, size_t sz)
+{
+	(void)p;
+	(void)sz;
+}
+
+static inline void xthal_dcache_region_writeback(void *p, size_t sz)
+{
+	(void)p;
+	(void)sz;
+}
+
+#endif
@@ -24,8 +24,17 @@
 #ifndef XRP_DSP_HW_H
 #define XRP_DSP_HW_H
 
+#include <stdint.h>
+
 void xrp_hw_send_host_irq(void);
 void xrp_hw_wait_device_irq(void);
 void xrp_hw_set_sync_data(void *p);
 
+#ifdef XRP_DSP_HOST
+/*
+ * Translate DSP physical address to the address in the host process.
+ */
+void *xrp_hw_p2v(uint32_t addr);
+#endif
+
 #endif
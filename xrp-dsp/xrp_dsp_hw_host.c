@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * xrp_dsp_hw implementation for the DSP side of XRP running as a host
+ * process together with the fast simulation host library.
+ *
+ * Memory is the set of sim-shmem regions of the device tree linked into
+ * the program, opened with shm_open just like the host library does.
+ * The device IRQ is the word of the shared memory that the host library
+ * writes to signal the DSP, it's waited for with futex. The host IRQ is
+ * a futex wake on the first word of the comm area, where the host library
+ * waits for the DSP.
+ *
+ * The device served by the process is selected by the XRP_DSP_DEVICE
+ * environment variable, 0 by default. Shared memory names with a PID
+ * format specifier are formatted with XRP_SIM_PID, or with the parent
+ * process PID when it's not set.
+ */
+
+#include <fcntl.h>
+#include <libfdt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xrp_dsp_hw.h"
+
+typedef uint32_t __u32;
+#include "xrp_hw_simple_dsp_interface.h"
+
+#ifndef FUTEX_WAIT
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#endif
+
+/*
+ * Upper bound of the device IRQ latency, for hosts that don't wake the
+ * futex, and of the time to notice simulation exit.
+ */
+#define XRP_HW_HOST_TIMEOUT_NS	1000000
+
+#ifdef DEBUG
+#define pr_debug printf
+#else
+static inline int pr_debug(const char *p, ...)
+{
+	(void)p;
+	return 0;
+}
+#endif
+
+extern char dt_blob_start[];
+extern void *xrp_dsp_comm_base;
+
+struct xrp_hw_region {
+	uint32_t start;
+	uint32_t size;
+	void *ptr;
+};
+
+static struct xrp_hw_region *regions;
+static int n_regions;
+
+static uint32_t *comm_word;
+static uint32_t *exit_word;
+static uint32_t *device_irq_word;
+static uint32_t device_irq_mask;
+
+static uint32_t getprop_u32(const void *value, int offset)
+{
+	fdt32_t v;
+
+	memcpy(&v, (const char *)value + offset, sizeof(v));
+	return fdt32_to_cpu(v);
+}
+
+void *xrp_hw_p2v(uint32_t addr)
+{
+	int i;
+
+	for (i = 0; i < n_regions; ++i)
+		if (addr >= regions[i].start &&
+		    addr - regions[i].start < regions[i].size)
+			return (char *)regions[i].ptr + addr - regions[i].start;
+	return NULL;
+}
+
+static int open_regions(void *fdt)
+{
+	const char *pid_env = getenv("XRP_SIM_PID");
+	int pid = pid_env ? atoi(pid_env) : (int)getppid();
+	const void *reg, *names, *exit_loc;
+	int reg_len, names_len, len;
+	int offset, name_offset = 0;
+	int i;
+
+	offset = fdt_node_offset_by_compatible(fdt, -1, "cdns,sim-shmem");
+	if (offset < 0) {
+		printf("%s: cdns,sim-shmem device not found\n", __func__);
+		return 0;
+	}
+	reg = fdt_getprop(fdt, offset, "reg", &reg_len);
+	names = fdt_getprop(fdt, offset, "reg-names", &names_len);
+	if (!reg || !names) {
+		printf("%s: reg or reg-names not found\n", __func__);
+		return 0;
+	}
+	regions = calloc(reg_len / 8, sizeof(*regions));
+	if (!regions)
+		return 0;
+
+	for (i = 0; i < reg_len / 8; ++i) {
+		const char *name_fmt = (const char *)names + name_offset;
+		char name[PATH_MAX];
+		int fd;
+
+		snprintf(name, sizeof(name), name_fmt, pid);
+		name_offset += strlen(name_fmt) + 1;
+
+		regions[i].start = getprop_u32(reg, i * 8);
+		regions[i].size = getprop_u32(reg, i * 8 + 4);
+		fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+		if (fd < 0) {
+			perror("shm_open");
+			return 0;
+		}
+		if (ftruncate(fd, regions[i].size) < 0) {
+			perror("ftruncate");
+			close(fd);
+			return 0;
+		}
+		regions[i].ptr = mmap(NULL, regions[i].size,
+				      PROT_READ | PROT_WRITE,
+				      MAP_SHARED, fd, 0);
+		close(fd);
+		if (regions[i].ptr == MAP_FAILED) {
+			perror("mmap");
+			return 0;
+		}
+		n_regions = i + 1;
+	}
+
+	exit_loc = fdt_getprop(fdt, offset, "exit-loc", &len);
+	if (exit_loc && len >= 4)
+		exit_word = xrp_hw_p2v(getprop_u32(exit_loc, 0));
+	return 1;
+}
+
+/*
+ * Find comm area of the device with the given index. Devices are
+ * enumerated in the same order as the host library does it.
+ */
+static void *find_comm(void *fdt, int idx)
+{
+	static const struct {
+		const char *compatible;
+		int comm_offset;
+	} match[] = {
+		{ "cdns,xrp", 8 },
+		{ "cdns,xrp,v1", 0 },
+		{ "cdns,xrp-hw-simple", 8 },
+		{ "cdns,xrp-hw-simple,v1", 0 },
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(match) / sizeof(match[0]); ++i) {
+		int offset = -1;
+
+		for (;;) {
+			const void *reg;
+			int len;
+
+			offset = fdt_node_offset_by_compatible(fdt, offset,
+							       match[i].compatible);
+			if (offset < 0)
+				break;
+			reg = fdt_getprop(fdt, offset, "reg", &len);
+			if (!reg || len < match[i].comm_offset + 8)
+				continue;
+			if (idx-- == 0)
+				return xrp_hw_p2v(getprop_u32(reg,
+							      match[i].comm_offset));
+		}
+	}
+	return NULL;
+}
+
+static void __attribute__((constructor)) xrp_hw_host_init(void)
+{
+	const char *device_env = getenv("XRP_DSP_DEVICE");
+	void *fdt = &dt_blob_start;
+
+	if (!open_regions(fdt))
+		exit(1);
+
+	xrp_dsp_comm_base = find_comm(fdt, device_env ? atoi(device_env) : 0);
+	if (!xrp_dsp_comm_base) {
+		printf("%s: comm area of the device is not found\n", __func__);
+		exit(1);
+	}
+	comm_word = xrp_dsp_comm_base;
+}
+
+static void check_exit(void)
+{
+	if (exit_word && __atomic_load_n(exit_word, __ATOMIC_ACQUIRE))
+		exit(0);
+}
+
+void xrp_hw_send_host_irq(void)
+{
+	syscall(SYS_futex, comm_word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Until the device IRQ is configured by the host changes of the comm area
+ * are waited for instead.
+ */
+void xrp_hw_wait_device_irq(void)
+{
+	struct timespec timeout = {
+		.tv_nsec = XRP_HW_HOST_TIMEOUT_NS,
+	};
+	uint32_t *word = device_irq_word ? device_irq_word : comm_word;
+	uint32_t v = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+
+	check_exit();
+	if (!device_irq_word || !(v & device_irq_mask))
+		syscall(SYS_futex, word, FUTEX_WAIT, v, &timeout, NULL, 0);
+	if (device_irq_word)
+		__atomic_fetch_and(device_irq_word, ~device_irq_mask,
+				   __ATOMIC_ACQ_REL);
+	check_exit();
+}
+
+void xrp_hw_set_sync_data(void *p)
+{
+	struct xrp_hw_simple_sync_data *hw_sync = p;
+
+	if (hw_sync->device_irq_mode == XRP_DSP_SYNC_IRQ_MODE_LEVEL ||
+	    hw_sync->device_irq_mode == XRP_DSP_SYNC_IRQ_MODE_EDGE) {
+		device_irq_word = xrp_hw_p2v(hw_sync->device_mmio_base +
+					     hw_sync->device_irq_offset);
+		device_irq_mask = 1u << hw_sync->device_irq_bit;
+		pr_debug("%s: device IRQ word @%p, mask 0x%08x\n",
+			 __func__, device_irq_word, device_irq_mask);
+	} else {
+		device_irq_word = NULL;
+	}
+}
@@ -25,12 +25,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef XRP_DSP_HOST
 #include <xtensa/corebits.h>
 #include <xtensa/xtruntime.h>
+#endif
 #include "xrp_api.h"
 #include "xrp_dsp_hw.h"
 #include "example_namespace.h"
 
+#ifdef XRP_DSP_HOST
+static void register_exception_handlers(void)
+{
+}
+#else
 static void hang(void) __attribute__((noreturn));
 static void hang(void)
 {
@@ -88,6 +95,7 @@ static void register_exception_handlers(void)
 		_xtos_set_exception_handler(cause[i], exception);
 	}
 }
+#endif
 
 void xrp_run_command(const void *in_data, size_t in_data_size,
 		     void *out_data, size_t out_data_size,
@@ -110,6 +118,7 @@ static enum xrp_status example_v1_handler(void *handler_context,
 					  struct xrp_buffer_group *buffer_group)
 {
 	size_t i;
+	size_t n_buffers = 0;
 	uint32_t sz = 0;
 
 	(void)handler_context;
@@ -151,11 +160,38 @@ static enum xrp_status example_v1_handler(void *handler_context,
 		xrp_release_buffer(dbuf, NULL);
 	}
 
-	sz = 0;
 	xrp_buffer_group_get_info(buffer_group, XRP_BUFFER_GROUP_SIZE_SIZE_T,
-				  0, &sz, sizeof(sz), NULL);
+				  0, &n_buffers, sizeof(n_buffers), NULL);
+
+	return n_buffers == i ? XRP_STATUS_SUCCESS : XRP_STATUS_FAILURE;
+}
+
+/*
+ * Command which completion is deferred until the next iteration of the
+ * dispatch loop, as if it was run by an accelerator.
+ */
+static struct {
+	struct xrp_command_token *token;
+	enum xrp_status status;
+} deferred;
 
-	return sz == i ? XRP_STATUS_SUCCESS : XRP_STATUS_FAILURE;
+static enum xrp_status defer_command(enum xrp_status command_status)
+{
+	enum xrp_status status;
+
+	deferred.token = xrp_defer_command(&status);
+	if (status != XRP_STATUS_SUCCESS)
+		return XRP_STATUS_FAILURE;
+	deferred.status = command_status;
+	return XRP_STATUS_PENDING;
+}
+
+static void complete_deferred_command(void)
+{
+	if (deferred.token) {
+		xrp_complete_command(deferred.token, deferred.status, NULL);
+		deferred.token = NULL;
+	}
 }
 
 static enum xrp_status example_v2_handler(void *handler_context,
@@ -178,6 +214,10 @@ static enum xrp_status example_v2_handler(void *handler_context,
 		return XRP_STATUS_SUCCESS;
 	case EXAMPLE_V2_CMD_FAIL:
 		return XRP_STATUS_FAILURE;
+	case EXAMPLE_V2_CMD_DEFERRED_OK:
+		return defer_command(XRP_STATUS_SUCCESS);
+	case EXAMPLE_V2_CMD_DEFERRED_FAIL:
+		return defer_command(XRP_STATUS_FAILURE);
 	default:
 		return XRP_STATUS_FAILURE;
 	}
@@ -245,7 +285,9 @@ int main(void)
 	}
 	for (;;) {
 		status = xrp_device_dispatch(device);
-		if (status == XRP_STATUS_PENDING)
+		if (deferred.token)
+			complete_deferred_command();
+		else if (status == XRP_STATUS_PENDING)
 			xrp_hw_wait_device_irq();
 	}
 	return 0;
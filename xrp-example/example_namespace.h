@@ -37,6 +37,8 @@
 enum {
 	EXAMPLE_V2_CMD_OK,
 	EXAMPLE_V2_CMD_FAIL,
+	EXAMPLE_V2_CMD_DEFERRED_OK,
+	EXAMPLE_V2_CMD_DEFERRED_FAIL,
 };
 
 struct example_v2_cmd {
@@ -440,6 +440,544 @@ static void f7(int devid)
 	assert(status == XRP_STATUS_SUCCESS);
 }
 
+/* Test sealed buffer group */
+static void f8(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue;
+	struct xrp_buffer_group *group;
+	struct xrp_buffer *buf1;
+	struct xrp_buffer *buf2;
+	uint32_t sz = 4096;
+	void *data1;
+	void *data2;
+	int i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	queue = xrp_create_ns_queue(device, XRP_EXAMPLE_V1_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	group = xrp_create_buffer_group(&status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	buf1 = xrp_create_buffer(device, sz, NULL, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	buf2 = xrp_create_buffer(device, sz, NULL, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_add_buffer_to_group(group, buf1, XRP_READ, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_add_buffer_to_group(group, buf2, XRP_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_seal_buffer_group(group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_seal_buffer_group(group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_add_buffer_to_group(group, buf1, XRP_READ, &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+	xrp_set_buffer_in_group(group, 0, buf2, XRP_READ, &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+
+	for (i = 0; i < 4; ++i) {
+		data1 = xrp_map_buffer(buf1, 0, sz, XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		memset(data1, i + 1, sz);
+		xrp_unmap_buffer(buf1, data1, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+
+		xrp_run_command_sync(queue, &sz, sizeof(sz), NULL, 0, group, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+
+		data1 = xrp_map_buffer(buf1, 0, sz, XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		data2 = xrp_map_buffer(buf2, 0, sz, XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		assert(memcmp(data1, data2, sz) == 0);
+		xrp_unmap_buffer(buf1, data1, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_unmap_buffer(buf2, data2, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	xrp_release_buffer_group(group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_buffer(buf1, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_buffer(buf2, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_queue(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+}
+
+/* Test command list recording, patching and replay */
+static void f9(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue;
+	struct xrp_command_list *list;
+	struct xrp_buffer_group *group[2];
+	struct xrp_buffer *buf[3];
+	struct xrp_event *event;
+	uint32_t in[2] = {4096, 0};
+	uint8_t out[2][sizeof(in)];
+	size_t idx[2];
+	void *data[3];
+	uint32_t frame;
+	size_t i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	queue = xrp_create_ns_queue(device, XRP_EXAMPLE_V1_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	for (i = 0; i < 3; ++i) {
+		buf[i] = xrp_create_buffer(device, in[0], NULL, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	for (i = 0; i < 2; ++i) {
+		group[i] = xrp_create_buffer_group(&status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group[i], buf[i], XRP_READ, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group[i], buf[i + 1], XRP_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	list = xrp_create_command_list(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2; ++i) {
+		idx[i] = xrp_add_command_to_list(list, in, sizeof(in),
+						 out[i], sizeof(out[i]),
+						 group[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		assert(idx[i] == i);
+		status = -1;
+		xrp_release_buffer_group(group[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	xrp_set_command_in_data(list, 0, sizeof(in), &frame, 1, &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+
+	for (frame = 1; frame < 5; ++frame) {
+		data[0] = xrp_map_buffer(buf[0], 0, in[0], XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		memset(data[0], frame, in[0]);
+		xrp_unmap_buffer(buf[0], data[0], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+
+		for (i = 0; i < 2; ++i) {
+			xrp_set_command_in_data(list, idx[i], sizeof(uint32_t),
+						&frame, sizeof(frame), &status);
+			assert(status == XRP_STATUS_SUCCESS);
+			status = -1;
+		}
+
+		xrp_enqueue_command_list(list, &event, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_wait(event, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_event_status(event, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_release_event(event, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+
+		for (i = 0; i < 2; ++i)
+			assert(out[i][sizeof(uint32_t)] ==
+			       (uint8_t)(frame + sizeof(uint32_t)));
+
+		data[0] = xrp_map_buffer(buf[0], 0, in[0], XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		data[2] = xrp_map_buffer(buf[2], 0, in[0], XRP_READ_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		assert(memcmp(data[0], data[2], in[0]) == 0);
+		xrp_unmap_buffer(buf[0], data[0], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_unmap_buffer(buf[2], data[2], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	xrp_release_command_list(list, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 3; ++i) {
+		xrp_release_buffer(buf[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	xrp_release_queue(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+}
+
+/* Test sub-buffers */
+static void f10(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue;
+	struct xrp_buffer_group *group;
+	struct xrp_buffer *buf;
+	struct xrp_buffer *sub[2];
+	uint32_t sz = 4096;
+	char *data;
+	size_t i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	queue = xrp_create_ns_queue(device, XRP_EXAMPLE_V1_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	buf = xrp_create_buffer(device, 2 * sz, NULL, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_create_sub_buffer(buf, sz + 1, sz, &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+
+	group = xrp_create_buffer_group(&status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2; ++i) {
+		sub[i] = xrp_create_sub_buffer(buf, i * sz, sz, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group, sub[i],
+					i ? XRP_WRITE : XRP_READ, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_release_buffer(sub[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	data = xrp_map_buffer(buf, 0, 2 * sz, XRP_READ_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2 * sz; ++i)
+		data[i] = i / 13;
+	xrp_unmap_buffer(buf, data, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_run_command_sync(queue, &sz, sizeof(sz), NULL, 0, group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_buffer_group(group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	data = xrp_map_buffer(buf, 0, 2 * sz, XRP_READ_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	assert(memcmp(data, data + sz, sz) == 0);
+	xrp_unmap_buffer(buf, data, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_release_buffer(buf, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_queue(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+}
+
+/* Test commands with dependencies on other queues */
+static void f11(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue[2];
+	struct xrp_queue *queue_v2;
+	struct xrp_buffer_group *group[2];
+	struct xrp_buffer *buf[3];
+	struct xrp_event *event[3];
+	struct example_v2_cmd cmd = {
+		.cmd = EXAMPLE_V2_CMD_FAIL,
+	};
+	uint32_t sz = 4096;
+	void *p = malloc(sz);
+	void *data[3];
+	size_t i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2; ++i) {
+		queue[i] = xrp_create_ns_queue(device, XRP_EXAMPLE_V1_NSID, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	queue_v2 = xrp_create_ns_queue(device, XRP_EXAMPLE_V2_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	for (i = 0; i < 3; ++i) {
+		buf[i] = xrp_create_buffer(device, sz, i == 1 ? p : NULL, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	for (i = 0; i < 2; ++i) {
+		group[i] = xrp_create_buffer_group(&status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group[i], buf[i], XRP_READ, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group[i], buf[i + 1], XRP_WRITE, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	data[0] = xrp_map_buffer(buf[0], 0, sz, XRP_READ_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	memset(data[0], 0x5a, sz);
+	xrp_unmap_buffer(buf[0], data[0], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_enqueue_command(queue[0], &sz, sizeof(sz), NULL, 0,
+			    group[0], event + 0, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_enqueue_command_after(queue[1], &sz, sizeof(sz), NULL, 0,
+				  group[1], event, 1, event + 1, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_wait(event[1], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_event_status(event[1], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	data[0] = xrp_map_buffer(buf[0], 0, sz, XRP_READ_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	data[2] = xrp_map_buffer(buf[2], 0, sz, XRP_READ_WRITE, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	assert(memcmp(data[0], data[2], sz) == 0);
+	xrp_unmap_buffer(buf[0], data[0], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_unmap_buffer(buf[2], data[2], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	for (i = 0; i < 2; ++i) {
+		xrp_release_event(event[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	xrp_enqueue_command(queue_v2, &cmd, sizeof(cmd), NULL, 0,
+			    NULL, event + 2, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_enqueue_command_after(queue[1], &sz, sizeof(sz), NULL, 0,
+				  group[1], event + 2, 1, event + 1, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_wait(event[1], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_event_status(event[1], &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+	xrp_release_event(event[1], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_event(event[2], &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	for (i = 0; i < 2; ++i) {
+		xrp_release_buffer_group(group[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_release_queue(queue[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	for (i = 0; i < 3; ++i) {
+		xrp_release_buffer(buf[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	xrp_release_queue(queue_v2, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	free(p);
+}
+
+/* Test buffers in memory allocated with xrp_host_alloc */
+static void f12(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue;
+	struct xrp_buffer_group *group;
+	struct xrp_buffer *buf[2];
+	uint32_t sz = 4096;
+	char *data;
+	size_t i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	queue = xrp_create_ns_queue(device, XRP_EXAMPLE_V1_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	data = xrp_host_alloc(device, 2 * sz, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2 * sz; ++i)
+		data[i] = i / 11;
+
+	group = xrp_create_buffer_group(&status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2; ++i) {
+		buf[i] = xrp_create_buffer(device, sz, data + i * sz, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+		xrp_add_buffer_to_group(group, buf[i],
+					i ? XRP_WRITE : XRP_READ, &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+
+	xrp_run_command_sync(queue, &sz, sizeof(sz), NULL, 0, group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	assert(memcmp(data, data + sz, sz) == 0);
+
+	xrp_release_buffer_group(group, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	for (i = 0; i < 2; ++i) {
+		xrp_release_buffer(buf[i], &status);
+		assert(status == XRP_STATUS_SUCCESS);
+		status = -1;
+	}
+	xrp_host_free(device, data, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_host_free(device, data, &status);
+	assert(status == XRP_STATUS_FAILURE);
+	status = -1;
+	xrp_release_queue(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+}
+
+/* Test commands with deferred completion */
+static void f13(int devid)
+{
+	enum xrp_status status = -1;
+	struct xrp_device *device;
+	struct xrp_queue *queue;
+	struct example_v2_cmd cmd = {
+		.cmd = EXAMPLE_V2_CMD_DEFERRED_OK,
+	};
+	int i;
+
+	device = xrp_open_device(devid, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	queue = xrp_create_ns_queue(device, XRP_EXAMPLE_V2_NSID, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	for (i = 0; i < 4; ++i) {
+		cmd.cmd = (i & 1) ? EXAMPLE_V2_CMD_DEFERRED_FAIL :
+			EXAMPLE_V2_CMD_DEFERRED_OK;
+		xrp_run_command_sync(queue,
+				     &cmd, sizeof(cmd),
+				     NULL, 0,
+				     NULL, &status);
+		assert(status == ((i & 1) ? XRP_STATUS_FAILURE :
+				  XRP_STATUS_SUCCESS));
+		status = -1;
+	}
+
+	cmd.cmd = EXAMPLE_V2_CMD_OK;
+	xrp_run_command_sync(queue,
+			     &cmd, sizeof(cmd),
+			     NULL, 0,
+			     NULL, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+
+	xrp_release_queue(queue, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+	status = -1;
+	xrp_release_device(device, &status);
+	assert(status == XRP_STATUS_SUCCESS);
+}
+
 int main(int argc, char **argv)
 {
 	int devid = 0;
@@ -459,5 +997,17 @@ int main(int argc, char **argv)
 	f6(devid);
 	printf("=======================================================\n");
 	f7(devid);
+	printf("=======================================================\n");
+	f8(devid);
+	printf("=======================================================\n");
+	f9(devid);
+	printf("=======================================================\n");
+	f10(devid);
+	printf("=======================================================\n");
+	f11(devid);
+	printf("=======================================================\n");
+	f12(devid);
+	printf("=======================================================\n");
+	f13(devid);
 	return 0;
 }
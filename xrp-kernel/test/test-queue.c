@@ -143,6 +143,40 @@ static void test_queue_buf(int fd)
 	}
 }
 
+static void test_queue_batch(int fd)
+{
+	char buf[5];
+	struct xrp_ioctl_queue q[2] = {{0}};
+	struct xrp_ioctl_queue_batch b = {0};
+	int rc;
+
+	q[0].in_data_addr = (__u64)(uintptr_t)(buf + 1);
+	q[0].in_data_size = 4;
+	q[1].in_data_addr = 0x90000000;
+	q[1].in_data_size = 4;
+
+	b.n_queue = 2;
+	b.queue_addr = (__u64)(uintptr_t)q;
+
+	rc = ioctl(fd, XRP_IOCTL_QUEUE_BATCH, &b);
+	if (rc == -1 && b.n_done == 1) {
+		perror("XFAIL batch 1");
+	} else {
+		++fails;
+		fprintf(stderr, "FAIL batch 1\n");
+	}
+
+	q[1] = q[0];
+	b.n_done = 0;
+	rc = ioctl(fd, XRP_IOCTL_QUEUE_BATCH, &b);
+	if (rc == -1 || b.n_done != 2) {
+		++fails;
+		perror("FAIL batch 2");
+	} else {
+		fprintf(stderr, "PASS batch 2\n");
+	}
+}
+
 int main()
 {
 	int fd = open("/dev/xvp0", O_RDWR);
@@ -150,6 +184,7 @@ int main()
 	test_queue_in(fd);
 	test_queue_out(fd);
 	test_queue_buf(fd);
+	test_queue_batch(fd);
 
 	return fails;
 }
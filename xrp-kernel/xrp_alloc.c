@@ -78,22 +78,22 @@ static void kfree(void *p)
 
 static void mutex_init(struct mutex *mutex)
 {
-	(void)mutex;
+	pthread_mutex_init(&mutex->lock, NULL);
 }
 
 static void mutex_lock(struct mutex *mutex)
 {
-	(void)mutex;
+	pthread_mutex_lock(&mutex->lock);
 }
 
 static void mutex_unlock(struct mutex *mutex)
 {
-	(void)mutex;
+	pthread_mutex_unlock(&mutex->lock);
 }
 
 static void atomic_set(atomic_t *p, uint32_t v)
 {
-	*((volatile atomic_t *)p) = v;
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
 }
 
 #define container_of(ptr, type, member) ({				\
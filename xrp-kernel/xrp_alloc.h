@@ -29,6 +29,7 @@
 
 #ifndef __KERNEL__
 
+#include <pthread.h>
 #include <stdint.h>
 
 typedef uint32_t u32;
@@ -36,16 +37,17 @@ typedef uint32_t phys_addr_t;
 typedef uint32_t atomic_t;
 
 struct mutex {
+	pthread_mutex_t lock;
 };
 
 static inline void atomic_inc(atomic_t *v)
 {
-	++*(volatile atomic_t *)v;
+	__atomic_add_fetch(v, 1, __ATOMIC_RELAXED);
 }
 
 static inline int atomic_dec_and_test(atomic_t *v)
 {
-	return --*(volatile atomic_t *)v == 0;
+	return __atomic_sub_fetch(v, 1, __ATOMIC_ACQ_REL) == 0;
 }
 
 #endif
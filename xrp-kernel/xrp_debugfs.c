@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2017 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively you can use and distribute this file under the terms of
+ * the GNU General Public License version 2 or later.
+ */
+
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include "xrp_debugfs.h"
+#include "xrp_internal.h"
+#include "xrp_kernel_dsp_interface.h"
+
+/*
+ * Bucket 0 counts zero durations, bucket i > 0 counts durations in
+ * [2^(i - 1), 2^i) ns, the last bucket counts everything longer.
+ */
+#define XRP_STATS_BUCKETS 36
+#define XRP_STATS_MAX_NS 64
+
+struct xrp_stats_hist {
+	atomic64_t count;
+	atomic64_t sum;
+	atomic64_t max;
+	atomic64_t bucket[XRP_STATS_BUCKETS];
+};
+
+struct xrp_stats_set {
+	atomic64_t count[XRP_STATS_COUNTERS];
+	struct xrp_stats_hist hist[XRP_STATS_PHASES];
+};
+
+struct xrp_stats_ns {
+	struct hlist_node node;
+	u8 nsid[XRP_DSP_CMD_NAMESPACE_ID_SIZE];
+	struct xrp_stats_set set;
+};
+
+struct xrp_stats {
+	struct dentry *dir;
+	struct dentry *ns_dir;
+	u64 irq_ns;
+
+	struct xrp_stats_set dev;
+	struct xrp_stats_set def;
+
+	struct mutex ns_lock;
+	unsigned n_ns;
+	DECLARE_HASHTABLE(ns, 4);
+};
+
+static const char * const xrp_stats_phase_name[XRP_STATS_PHASES] = {
+	[XRP_STATS_COPY_IN] = "copy_in",
+	[XRP_STATS_MAP] = "map",
+	[XRP_STATS_MAP_GUP] = "map_gup",
+	[XRP_STATS_MAP_PFN] = "map_pfn",
+	[XRP_STATS_MAP_BOUNCE] = "map_bounce",
+	[XRP_STATS_MAP_CACHE] = "map_cache",
+	[XRP_STATS_LOCK] = "lock",
+	[XRP_STATS_FILL] = "fill",
+	[XRP_STATS_DSP] = "dsp",
+	[XRP_STATS_WAKEUP] = "wakeup",
+	[XRP_STATS_UNMAP] = "unmap",
+	[XRP_STATS_TOTAL] = "total",
+};
+
+static const char * const xrp_stats_counter_name[XRP_STATS_COUNTERS] = {
+	[XRP_STATS_REQUESTS] = "requests",
+	[XRP_STATS_ERRORS] = "errors",
+	[XRP_STATS_TIMEOUTS] = "timeouts",
+	[XRP_STATS_BUFFERS] = "buffers",
+	[XRP_STATS_BOUNCE_MAPS] = "bounce_maps",
+	[XRP_STATS_BOUNCE_BYTES] = "bounce_bytes",
+};
+
+static struct dentry *xrp_debugfs_root;
+
+static void xrp_stats_hist_add(struct xrp_stats_hist *hist, u64 v)
+{
+	unsigned bucket = min_t(unsigned, fls64(v), XRP_STATS_BUCKETS - 1);
+	s64 max = atomic64_read(&hist->max);
+
+	atomic64_inc(&hist->count);
+	atomic64_add(v, &hist->sum);
+	atomic64_inc(&hist->bucket[bucket]);
+
+	while ((s64)v > max) {
+		s64 old = atomic64_cmpxchg(&hist->max, max, v);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+static void xrp_stats_set_add(struct xrp_stats_set *set,
+			      const struct xrp_request_stats *stats,
+			      bool sample)
+{
+	int i;
+
+	for (i = 0; i < XRP_STATS_COUNTERS; ++i)
+		if (stats->count[i])
+			atomic64_add(stats->count[i], &set->count[i]);
+
+	/*
+	 * Only sample completed requests, and only phases that they went
+	 * through.
+	 */
+	if (!sample)
+		return;
+
+	for (i = 0; i < XRP_STATS_PHASES; ++i)
+		if (stats->ns[i])
+			xrp_stats_hist_add(set->hist + i, stats->ns[i]);
+}
+
+static void xrp_stats_set_reset(struct xrp_stats_set *set)
+{
+	int i, j;
+
+	for (i = 0; i < XRP_STATS_COUNTERS; ++i)
+		atomic64_set(&set->count[i], 0);
+	for (i = 0; i < XRP_STATS_PHASES; ++i) {
+		struct xrp_stats_hist *hist = set->hist + i;
+
+		atomic64_set(&hist->count, 0);
+		atomic64_set(&hist->sum, 0);
+		atomic64_set(&hist->max, 0);
+		for (j = 0; j < XRP_STATS_BUCKETS; ++j)
+			atomic64_set(&hist->bucket[j], 0);
+	}
+}
+
+static int xrp_stats_counters_show(struct seq_file *s, void *data)
+{
+	struct xrp_stats_set *set = s->private;
+	int i;
+
+	for (i = 0; i < XRP_STATS_COUNTERS; ++i)
+		seq_printf(s, "%s %lld\n", xrp_stats_counter_name[i],
+			   (long long)atomic64_read(&set->count[i]));
+	return 0;
+}
+
+static int xrp_stats_histograms_show(struct seq_file *s, void *data)
+{
+	struct xrp_stats_set *set = s->private;
+	int i, j;
+
+	for (i = 0; i < XRP_STATS_PHASES; ++i) {
+		struct xrp_stats_hist *hist = set->hist + i;
+		s64 count = atomic64_read(&hist->count);
+
+		seq_printf(s, "%s: count %lld avg_ns %lld max_ns %lld\n",
+			   xrp_stats_phase_name[i], (long long)count,
+			   count ? (long long)div64_s64(atomic64_read(&hist->sum),
+							 count) : 0ll,
+			   (long long)atomic64_read(&hist->max));
+
+		for (j = 0; j < XRP_STATS_BUCKETS; ++j) {
+			s64 v = atomic64_read(&hist->bucket[j]);
+
+			if (!v)
+				continue;
+			if (j == 0)
+				seq_printf(s, "  %12s %12d: %lld\n",
+					   "", 0, (long long)v);
+			else if (j == XRP_STATS_BUCKETS - 1)
+				seq_printf(s, "  %12llu %12s: %lld\n",
+					   1ull << (j - 1), "-",
+					   (long long)v);
+			else
+				seq_printf(s, "  %12llu %12llu: %lld\n",
+					   1ull << (j - 1), (1ull << j) - 1,
+					   (long long)v);
+		}
+	}
+	return 0;
+}
+
+static int xrp_stats_counters_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xrp_stats_counters_show, inode->i_private);
+}
+
+static int xrp_stats_histograms_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xrp_stats_histograms_show, inode->i_private);
+}
+
+static ssize_t xrp_stats_reset_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct xrp_stats *stats = file->private_data;
+	struct xrp_stats_ns *ns;
+	int bkt;
+
+	xrp_stats_set_reset(&stats->dev);
+	xrp_stats_set_reset(&stats->def);
+
+	mutex_lock(&stats->ns_lock);
+	hash_for_each(stats->ns, bkt, ns, node)
+		xrp_stats_set_reset(&ns->set);
+	mutex_unlock(&stats->ns_lock);
+
+	return count;
+}
+
+static const struct file_operations xrp_stats_counters_fops = {
+	.owner = THIS_MODULE,
+	.open = xrp_stats_counters_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations xrp_stats_histograms_fops = {
+	.owner = THIS_MODULE,
+	.open = xrp_stats_histograms_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations xrp_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = xrp_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+static void xrp_stats_set_create_files(struct dentry *dir,
+				       struct xrp_stats_set *set)
+{
+	debugfs_create_file("counters", 0444, dir, set,
+			    &xrp_stats_counters_fops);
+	debugfs_create_file("histograms", 0444, dir, set,
+			    &xrp_stats_histograms_fops);
+}
+
+/*
+ * Namespace entries are only freed when the device goes away, so the entry
+ * may be used outside of the RCU read-side section.
+ */
+static struct xrp_stats_ns *xrp_stats_find_ns(struct xrp_stats *stats,
+					      const void *nsid, u32 key)
+{
+	struct xrp_stats_ns *ns;
+	struct xrp_stats_ns *found = NULL;
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu(stats->ns, ns, node, key)
+		if (!memcmp(ns->nsid, nsid, sizeof(ns->nsid))) {
+			found = ns;
+			break;
+		}
+	rcu_read_unlock();
+	return found;
+}
+
+/*
+ * Namespace statistics are created on the first request to the namespace.
+ * Their number is limited as namespace IDs come from the userspace; requests
+ * to namespaces beyond the limit are only accounted per device.
+ */
+static struct xrp_stats_set *xrp_stats_get_ns(struct xrp_stats *stats,
+					      const void *nsid)
+{
+	u32 key = jhash(nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE, 0);
+	struct xrp_stats_ns *ns;
+	char name[2 * XRP_DSP_CMD_NAMESPACE_ID_SIZE + 1];
+	struct dentry *dir;
+
+	ns = xrp_stats_find_ns(stats, nsid, key);
+	if (ns)
+		return &ns->set;
+
+	mutex_lock(&stats->ns_lock);
+	ns = xrp_stats_find_ns(stats, nsid, key);
+	if (ns || stats->n_ns >= XRP_STATS_MAX_NS)
+		goto out;
+
+	ns = kzalloc(sizeof(*ns), GFP_KERNEL);
+	if (!ns)
+		goto out;
+
+	memcpy(ns->nsid, nsid, sizeof(ns->nsid));
+	if (!IS_ERR_OR_NULL(stats->ns_dir)) {
+		sprintf(name, "%*phN", (int)sizeof(ns->nsid), ns->nsid);
+		dir = debugfs_create_dir(name, stats->ns_dir);
+		if (!IS_ERR_OR_NULL(dir))
+			xrp_stats_set_create_files(dir, &ns->set);
+	}
+
+	hash_add_rcu(stats->ns, &ns->node, key);
+	++stats->n_ns;
+out:
+	mutex_unlock(&stats->ns_lock);
+	return ns ? &ns->set : NULL;
+}
+
+void xrp_stats_irq(struct xvp *xvp)
+{
+	if (xvp->stats)
+		WRITE_ONCE(xvp->stats->irq_ns, ktime_get_ns());
+}
+
+/*
+ * Split the time since the command was sent into the DSP execution and
+ * the completion wake-up. The latter is only known when the completion
+ * was signalled by the IRQ.
+ */
+u64 xrp_stats_complete(struct xvp *xvp, struct xrp_request_stats *stats,
+		       u64 start)
+{
+	u64 now = ktime_get_ns();
+	u64 irq_ns = xvp->stats ? READ_ONCE(xvp->stats->irq_ns) : 0;
+
+	if (xvp->host_irq_mode && irq_ns >= start && irq_ns <= now) {
+		stats->ns[XRP_STATS_DSP] += irq_ns - start;
+		stats->ns[XRP_STATS_WAKEUP] += now - irq_ns;
+	} else {
+		stats->ns[XRP_STATS_DSP] += now - start;
+	}
+	return now;
+}
+
+void xrp_stats_commit(struct xvp *xvp, const void *nsid,
+		      struct xrp_request_stats *stats, long ret)
+{
+	struct xrp_stats_set *set;
+
+	if (!xvp->stats)
+		return;
+
+	stats->ns[XRP_STATS_TOTAL] = ktime_get_ns() - stats->start;
+	stats->count[XRP_STATS_REQUESTS] = 1;
+	if (ret < 0)
+		stats->count[XRP_STATS_ERRORS] = 1;
+	if (ret == -EBUSY)
+		stats->count[XRP_STATS_TIMEOUTS] = 1;
+
+	xrp_stats_set_add(&xvp->stats->dev, stats, ret == 0);
+
+	set = nsid ? xrp_stats_get_ns(xvp->stats, nsid) : &xvp->stats->def;
+	if (set)
+		xrp_stats_set_add(set, stats, ret == 0);
+}
+
+void xrp_debugfs_init(struct xvp *xvp)
+{
+	struct xrp_stats *stats;
+	struct dentry *dir;
+
+	if (IS_ERR_OR_NULL(xrp_debugfs_root))
+		return;
+
+	stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+	if (!stats)
+		return;
+
+	dir = debugfs_create_dir(xvp->miscdev.name, xrp_debugfs_root);
+	if (IS_ERR_OR_NULL(dir)) {
+		kfree(stats);
+		return;
+	}
+
+	mutex_init(&stats->ns_lock);
+	hash_init(stats->ns);
+	stats->dir = dir;
+
+	xrp_stats_set_create_files(dir, &stats->dev);
+	debugfs_create_file("reset", 0200, dir, stats,
+			    &xrp_stats_reset_fops);
+
+	dir = debugfs_create_dir("default", stats->dir);
+	if (!IS_ERR_OR_NULL(dir))
+		xrp_stats_set_create_files(dir, &stats->def);
+
+	stats->ns_dir = debugfs_create_dir("ns", stats->dir);
+
+	xvp->stats = stats;
+}
+
+void xrp_debugfs_deinit(struct xvp *xvp)
+{
+	struct xrp_stats *stats = xvp->stats;
+	struct xrp_stats_ns *ns;
+	struct hlist_node *tmp;
+	int bkt;
+
+	if (!stats)
+		return;
+
+	xvp->stats = NULL;
+	debugfs_remove_recursive(stats->dir);
+	hash_for_each_safe(stats->ns, bkt, tmp, ns, node)
+		kfree(ns);
+	kfree(stats);
+}
+
+void xrp_debugfs_module_init(void)
+{
+	xrp_debugfs_root = debugfs_create_dir("xrp", NULL);
+}
+
+void xrp_debugfs_module_exit(void)
+{
+	debugfs_remove_recursive(xrp_debugfs_root);
+	xrp_debugfs_root = NULL;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2017 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively you can use and distribute this file under the terms of
+ * the GNU General Public License version 2 or later.
+ */
+
+#ifndef XRP_DEBUGFS_H
+#define XRP_DEBUGFS_H
+
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+struct xvp;
+
+/*
+ * Phases of a command submission. Map sub-phases (map_*) are included in
+ * the map phase, all phases are included in the total.
+ */
+enum xrp_stats_phase {
+	XRP_STATS_COPY_IN,
+	XRP_STATS_MAP,
+	XRP_STATS_MAP_GUP,
+	XRP_STATS_MAP_PFN,
+	XRP_STATS_MAP_BOUNCE,
+	XRP_STATS_MAP_CACHE,
+	XRP_STATS_LOCK,
+	XRP_STATS_FILL,
+	XRP_STATS_DSP,
+	XRP_STATS_WAKEUP,
+	XRP_STATS_UNMAP,
+	XRP_STATS_TOTAL,
+
+	XRP_STATS_PHASES,
+};
+
+enum xrp_stats_counter {
+	XRP_STATS_REQUESTS,
+	XRP_STATS_ERRORS,
+	XRP_STATS_TIMEOUTS,
+	XRP_STATS_BUFFERS,
+	XRP_STATS_BOUNCE_MAPS,
+	XRP_STATS_BOUNCE_BYTES,
+
+	XRP_STATS_COUNTERS,
+};
+
+#ifdef CONFIG_DEBUG_FS
+
+struct xrp_request_stats {
+	u64 start;
+	u64 ns[XRP_STATS_PHASES];
+	u64 count[XRP_STATS_COUNTERS];
+};
+
+static inline u64 xrp_stats_now(void)
+{
+	return ktime_get_ns();
+}
+
+static inline u64 xrp_stats_start(struct xrp_request_stats *stats)
+{
+	*stats = (struct xrp_request_stats){
+		.start = ktime_get_ns(),
+	};
+	return stats->start;
+}
+
+/*
+ * Account time since start to the phase, return current time so that
+ * consecutive phases may be chained.
+ */
+static inline u64 xrp_stats_add(struct xrp_request_stats *stats,
+				enum xrp_stats_phase phase, u64 start)
+{
+	u64 now = ktime_get_ns();
+
+	stats->ns[phase] += now - start;
+	return now;
+}
+
+static inline void xrp_stats_count(struct xrp_request_stats *stats,
+				   enum xrp_stats_counter counter, u64 v)
+{
+	stats->count[counter] += v;
+}
+
+void xrp_stats_irq(struct xvp *xvp);
+u64 xrp_stats_complete(struct xvp *xvp, struct xrp_request_stats *stats,
+		       u64 start);
+void xrp_stats_commit(struct xvp *xvp, const void *nsid,
+		      struct xrp_request_stats *stats, long ret);
+
+void xrp_debugfs_init(struct xvp *xvp);
+void xrp_debugfs_deinit(struct xvp *xvp);
+void xrp_debugfs_module_init(void);
+void xrp_debugfs_module_exit(void);
+
+#else
+
+struct xrp_request_stats {
+};
+
+static inline u64 xrp_stats_now(void)
+{
+	return 0;
+}
+
+static inline u64 xrp_stats_start(struct xrp_request_stats *stats)
+{
+	return 0;
+}
+
+static inline u64 xrp_stats_add(struct xrp_request_stats *stats,
+				enum xrp_stats_phase phase, u64 start)
+{
+	return 0;
+}
+
+static inline void xrp_stats_count(struct xrp_request_stats *stats,
+				   enum xrp_stats_counter counter, u64 v)
+{
+}
+
+static inline void xrp_stats_irq(struct xvp *xvp)
+{
+}
+
+static inline u64 xrp_stats_complete(struct xvp *xvp,
+				     struct xrp_request_stats *stats,
+				     u64 start)
+{
+	return 0;
+}
+
+static inline void xrp_stats_commit(struct xvp *xvp, const void *nsid,
+				    struct xrp_request_stats *stats, long ret)
+{
+}
+
+static inline void xrp_debugfs_init(struct xvp *xvp)
+{
+}
+
+static inline void xrp_debugfs_deinit(struct xvp *xvp)
+{
+}
+
+static inline void xrp_debugfs_module_init(void)
+{
+}
+
+static inline void xrp_debugfs_module_exit(void)
+{
+}
+
+#endif
+
+#endif
@@ -37,6 +37,7 @@ struct device;
 struct firmware;
 struct xrp_hw_ops;
 struct xrp_allocation_pool;
+struct xrp_stats;
 
 struct xvp {
 	struct device *dev;
@@ -59,6 +60,8 @@ struct xvp {
 	struct xrp_allocation_pool *pool;
 	struct mutex comm_lock;
 	bool off;
+
+	struct xrp_stats *stats;
 };
 
 #endif
@@ -31,6 +31,7 @@
 #define XRP_IOCTL_FREE		_IO(XRP_IOCTL_MAGIC, 2)
 #define XRP_IOCTL_QUEUE		_IO(XRP_IOCTL_MAGIC, 3)
 #define XRP_IOCTL_QUEUE_NS	_IO(XRP_IOCTL_MAGIC, 4)
+#define XRP_IOCTL_QUEUE_BATCH	_IO(XRP_IOCTL_MAGIC, 5)
 
 struct xrp_ioctl_alloc {
 	__u32 size;
@@ -67,4 +68,10 @@ struct xrp_ioctl_queue {
 	__u64 nsid_addr;
 };
 
+struct xrp_ioctl_queue_batch {
+	__u32 n_queue;
+	__u32 n_done;
+	__u64 queue_addr;
+};
+
 #endif
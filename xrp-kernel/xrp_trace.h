@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively you can use and distribute this file under the terms of
+ * the GNU General Public License version 2 or later.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xrp
+
+#if !defined(XRP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define XRP_TRACE_H
+
+#include <linux/string.h>
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+#include "xrp_internal.h"
+#include "xrp_kernel_defs.h"
+#include "xrp_kernel_dsp_interface.h"
+
+#ifndef XRP_TRACE_MAP_NATIVE
+#define XRP_TRACE_MAP_NATIVE	0
+#define XRP_TRACE_MAP_KERNEL	1
+#define XRP_TRACE_MAP_ALIEN_GUP	2
+#define XRP_TRACE_MAP_ALIEN_PFN_MAP	3
+#define XRP_TRACE_MAP_ALIEN_COPY	4
+#endif
+
+#define xrp_trace_show_map_type(type) \
+	__print_symbolic(type, \
+			 { XRP_TRACE_MAP_NATIVE, "NATIVE" }, \
+			 { XRP_TRACE_MAP_KERNEL, "KERNEL" }, \
+			 { XRP_TRACE_MAP_ALIEN_GUP, "ALIEN_GUP" }, \
+			 { XRP_TRACE_MAP_ALIEN_PFN_MAP, "ALIEN_PFN_MAP" }, \
+			 { XRP_TRACE_MAP_ALIEN_COPY, "ALIEN_COPY" })
+
+/*
+ * Namespace ID is all zeroes for requests to the default namespace.
+ */
+#define xrp_trace_assign_nsid(dst, nsid) \
+	do { \
+		if (nsid) \
+			memcpy(dst, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE); \
+		else \
+			memset(dst, 0, XRP_DSP_CMD_NAMESPACE_ID_SIZE); \
+	} while (0)
+
+TRACE_EVENT(xrp_submit,
+	TP_PROTO(struct xvp *xvp, struct file *filp, const void *nsid,
+		 const struct xrp_ioctl_queue *queue),
+	TP_ARGS(xvp, filp, nsid, queue),
+	TP_STRUCT__entry(
+		__string(dev, xvp->miscdev.name)
+		__field(const void *, filp)
+		__array(u8, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE)
+		__field(u32, flags)
+		__field(u32, in_data_size)
+		__field(u32, out_data_size)
+		__field(u32, n_buffers)
+	),
+	TP_fast_assign(
+		__assign_str(dev, xvp->miscdev.name);
+		__entry->filp = filp;
+		xrp_trace_assign_nsid(__entry->nsid, nsid);
+		__entry->flags = queue->flags;
+		__entry->in_data_size = queue->in_data_size;
+		__entry->out_data_size = queue->out_data_size;
+		__entry->n_buffers = queue->buffer_size /
+			sizeof(struct xrp_ioctl_buffer);
+	),
+	TP_printk("%s filp=%p nsid=%*phN flags=0x%x in=%u out=%u buffers=%u",
+		  __get_str(dev), __entry->filp,
+		  XRP_DSP_CMD_NAMESPACE_ID_SIZE, __entry->nsid,
+		  __entry->flags, __entry->in_data_size,
+		  __entry->out_data_size, __entry->n_buffers)
+);
+
+TRACE_EVENT(xrp_map,
+	TP_PROTO(struct file *filp, const void *nsid, unsigned type,
+		 unsigned long vaddr, unsigned long size, phys_addr_t paddr,
+		 unsigned long flags),
+	TP_ARGS(filp, nsid, type, vaddr, size, paddr, flags),
+	TP_STRUCT__entry(
+		__field(const void *, filp)
+		__array(u8, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE)
+		__field(unsigned, type)
+		__field(unsigned long, vaddr)
+		__field(unsigned long, size)
+		__field(phys_addr_t, paddr)
+		__field(unsigned long, flags)
+	),
+	TP_fast_assign(
+		__entry->filp = filp;
+		xrp_trace_assign_nsid(__entry->nsid, nsid);
+		__entry->type = type;
+		__entry->vaddr = vaddr;
+		__entry->size = size;
+		__entry->paddr = paddr;
+		__entry->flags = flags;
+	),
+	TP_printk("filp=%p nsid=%*phN type=%s va=0x%lx size=%lu pa=0x%llx flags=0x%lx",
+		  __entry->filp, XRP_DSP_CMD_NAMESPACE_ID_SIZE, __entry->nsid,
+		  xrp_trace_show_map_type(__entry->type),
+		  __entry->vaddr, __entry->size,
+		  (unsigned long long)__entry->paddr,
+		  __entry->flags)
+);
+
+TRACE_EVENT(xrp_fill,
+	TP_PROTO(struct xvp *xvp, struct file *filp, const void *nsid,
+		 u32 in_data_size, size_t n_buffers),
+	TP_ARGS(xvp, filp, nsid, in_data_size, n_buffers),
+	TP_STRUCT__entry(
+		__string(dev, xvp->miscdev.name)
+		__field(const void *, filp)
+		__array(u8, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE)
+		__field(u32, in_data_size)
+		__field(size_t, n_buffers)
+	),
+	TP_fast_assign(
+		__assign_str(dev, xvp->miscdev.name);
+		__entry->filp = filp;
+		xrp_trace_assign_nsid(__entry->nsid, nsid);
+		__entry->in_data_size = in_data_size;
+		__entry->n_buffers = n_buffers;
+	),
+	TP_printk("%s filp=%p nsid=%*phN in=%u buffers=%zu",
+		  __get_str(dev), __entry->filp,
+		  XRP_DSP_CMD_NAMESPACE_ID_SIZE, __entry->nsid,
+		  __entry->in_data_size, __entry->n_buffers)
+);
+
+TRACE_EVENT(xrp_complete,
+	TP_PROTO(struct xvp *xvp, struct file *filp, const void *nsid,
+		 u32 out_data_size, long ret),
+	TP_ARGS(xvp, filp, nsid, out_data_size, ret),
+	TP_STRUCT__entry(
+		__string(dev, xvp->miscdev.name)
+		__field(const void *, filp)
+		__array(u8, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE)
+		__field(bool, irq)
+		__field(u32, out_data_size)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, xvp->miscdev.name);
+		__entry->filp = filp;
+		xrp_trace_assign_nsid(__entry->nsid, nsid);
+		__entry->irq = xvp->host_irq_mode;
+		__entry->out_data_size = out_data_size;
+		__entry->ret = ret;
+	),
+	TP_printk("%s filp=%p nsid=%*phN %s out=%u ret=%ld",
+		  __get_str(dev), __entry->filp,
+		  XRP_DSP_CMD_NAMESPACE_ID_SIZE, __entry->nsid,
+		  __entry->irq ? "irq" : "poll",
+		  __entry->out_data_size, __entry->ret)
+);
+
+TRACE_EVENT(xrp_unmap,
+	TP_PROTO(struct file *filp, const void *nsid, u32 out_data_size,
+		 size_t n_buffers, long ret),
+	TP_ARGS(filp, nsid, out_data_size, n_buffers, ret),
+	TP_STRUCT__entry(
+		__field(const void *, filp)
+		__array(u8, nsid, XRP_DSP_CMD_NAMESPACE_ID_SIZE)
+		__field(u32, out_data_size)
+		__field(size_t, n_buffers)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->filp = filp;
+		xrp_trace_assign_nsid(__entry->nsid, nsid);
+		__entry->out_data_size = out_data_size;
+		__entry->n_buffers = n_buffers;
+		__entry->ret = ret;
+	),
+	TP_printk("filp=%p nsid=%*phN out=%u buffers=%zu ret=%ld",
+		  __entry->filp, XRP_DSP_CMD_NAMESPACE_ID_SIZE, __entry->nsid,
+		  __entry->out_data_size, __entry->n_buffers, __entry->ret)
+);
+
+TRACE_EVENT(xrp_reboot,
+	TP_PROTO(struct xvp *xvp, int ret),
+	TP_ARGS(xvp, ret),
+	TP_STRUCT__entry(
+		__string(dev, xvp->miscdev.name)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev, xvp->miscdev.name);
+		__entry->ret = ret;
+	),
+	TP_printk("%s ret=%d", __get_str(dev), __entry->ret)
+);
+
+TRACE_EVENT(xrp_alloc,
+	TP_PROTO(struct file *filp, u32 size, u32 align, phys_addr_t paddr,
+		 unsigned long vaddr, long ret),
+	TP_ARGS(filp, size, align, paddr, vaddr, ret),
+	TP_STRUCT__entry(
+		__field(const void *, filp)
+		__field(u32, size)
+		__field(u32, align)
+		__field(phys_addr_t, paddr)
+		__field(unsigned long, vaddr)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->filp = filp;
+		__entry->size = size;
+		__entry->align = align;
+		__entry->paddr = paddr;
+		__entry->vaddr = vaddr;
+		__entry->ret = ret;
+	),
+	TP_printk("filp=%p size=%u align=0x%x pa=0x%llx va=0x%lx ret=%ld",
+		  __entry->filp, __entry->size, __entry->align,
+		  (unsigned long long)__entry->paddr, __entry->vaddr,
+		  __entry->ret)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xrp_trace
+#include <trace/define_trace.h>
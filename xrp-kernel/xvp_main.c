@@ -50,6 +50,7 @@
 #include <asm/mman.h>
 #include <asm/uaccess.h>
 #include "xrp_cma_alloc.h"
+#include "xrp_debugfs.h"
 #include "xrp_firmware.h"
 #include "xrp_hw.h"
 #include "xrp_internal.h"
@@ -57,6 +58,9 @@
 #include "xrp_kernel_dsp_interface.h"
 #include "xrp_private_alloc.h"
 
+#define CREATE_TRACE_POINTS
+#include "xrp_trace.h"
+
 #define DRIVER_NAME "xrp"
 #define XRP_DEFAULT_TIMEOUT 10
 
@@ -312,6 +316,7 @@ irqreturn_t xrp_irq_handler(int irq, struct xvp *xvp)
 	if (!xvp->comm || !xrp_cmd_complete(xvp))
 		return IRQ_NONE;
 
+	xrp_stats_irq(xvp);
 	complete(&xvp->completion);
 
 	return IRQ_HANDLED;
@@ -379,8 +384,11 @@ static long xrp_ioctl_alloc(struct file *filp,
 			   xrp_ioctl_alloc.size,
 			   xrp_ioctl_alloc.align,
 			   &xrp_allocation);
-	if (err)
+	if (err) {
+		trace_xrp_alloc(filp, xrp_ioctl_alloc.size,
+				xrp_ioctl_alloc.align, 0, 0, err);
 		return err;
+	}
 
 	xrp_allocation_queue(xvp_file, xrp_allocation);
 
@@ -389,6 +397,8 @@ static long xrp_ioctl_alloc(struct file *filp,
 			xrp_allocation_offset(xrp_allocation));
 
 	xrp_ioctl_alloc.addr = vaddr;
+	trace_xrp_alloc(filp, xrp_ioctl_alloc.size, xrp_ioctl_alloc.align,
+			xrp_allocation->start, vaddr, 0);
 
 	if (copy_to_user(p, &xrp_ioctl_alloc, sizeof(*p))) {
 		vm_munmap(vaddr, xrp_ioctl_alloc.size);
@@ -702,11 +712,13 @@ static unsigned xvp_get_region_vma_count(unsigned long virt,
 static long xrp_share_kernel(struct file *filp,
 			     unsigned long virt, unsigned long size,
 			     unsigned long flags, phys_addr_t *paddr,
-			     struct xrp_mapping *mapping)
+			     struct xrp_mapping *mapping,
+			     struct xrp_request_stats *stats)
 {
 	struct xvp_file *xvp_file = filp->private_data;
 	struct xvp *xvp = xvp_file->xvp;
 	phys_addr_t phys = __pa(virt);
+	u64 start = xrp_stats_now();
 	long err = 0;
 
 	pr_debug("%s: sharing kernel-only buffer: %pap\n", __func__, &phys);
@@ -722,6 +734,11 @@ static long xrp_share_kernel(struct file *filp,
 					    &mapping->alien_mapping);
 		set_fs(oldfs);
 		mapping->type = XRP_MAPPING_ALIEN | XRP_MAPPING_KERNEL;
+		xrp_stats_add(stats, XRP_STATS_MAP_BOUNCE, start);
+		if (err == 0) {
+			xrp_stats_count(stats, XRP_STATS_BOUNCE_MAPS, 1);
+			xrp_stats_count(stats, XRP_STATS_BOUNCE_BYTES, size);
+		}
 	} else {
 		mapping->type = XRP_MAPPING_KERNEL;
 		*paddr = phys;
@@ -731,6 +748,7 @@ static long xrp_share_kernel(struct file *filp,
 		} else if (flags & XRP_FLAG_READ) {
 			xvp->hw_ops->clean_cache((void *)virt, phys, size);
 		}
+		xrp_stats_add(stats, XRP_STATS_MAP_CACHE, start);
 	}
 	pr_debug("%s: mapping = %p, mapping->type = %d\n",
 		 __func__, mapping, mapping->type);
@@ -748,7 +766,8 @@ static long xrp_share_kernel(struct file *filp,
 static long __xrp_share_block(struct file *filp,
 			      unsigned long virt, unsigned long size,
 			      unsigned long flags, phys_addr_t *paddr,
-			      struct xrp_mapping *mapping)
+			      struct xrp_mapping *mapping,
+			      struct xrp_request_stats *stats)
 {
 	phys_addr_t phys = ~0ul;
 	struct xvp_file *xvp_file = filp->private_data;
@@ -757,6 +776,7 @@ static long __xrp_share_block(struct file *filp,
 	struct vm_area_struct *vma = find_vma(mm, virt);
 	bool do_cache = true;
 	long rc = -EINVAL;
+	u64 start;
 
 	if (!vma) {
 		pr_debug("%s: no vma for vaddr/size = 0x%08lx/0x%08lx\n",
@@ -836,15 +856,19 @@ static long __xrp_share_block(struct file *filp,
 			 __func__, virt);
 
 		if (vma && vma->vm_flags & (VM_IO | VM_PFNMAP)) {
+			start = xrp_stats_now();
 			rc = xvp_pfn_virt_to_phys(xvp_file, vma,
 						  virt, size,
 						  &phys,
 						  alien_mapping);
+			xrp_stats_add(stats, XRP_STATS_MAP_PFN, start);
 		} else {
 			up_read(&mm->mmap_sem);
+			start = xrp_stats_now();
 			rc = xvp_gup_virt_to_phys(xvp_file, virt,
 						  size, &phys,
 						  alien_mapping);
+			xrp_stats_add(stats, XRP_STATS_MAP_GUP, start);
 			down_read(&mm->mmap_sem);
 		}
 
@@ -852,9 +876,16 @@ static long __xrp_share_block(struct file *filp,
 		 * If we couldn't share try to make a shadow copy.
 		 */
 		if (rc < 0) {
+			start = xrp_stats_now();
 			rc = xvp_copy_virt_to_phys(xvp_file, flags,
 						   virt, size, &phys,
 						   alien_mapping);
+			xrp_stats_add(stats, XRP_STATS_MAP_BOUNCE, start);
+			if (rc == 0) {
+				xrp_stats_count(stats, XRP_STATS_BOUNCE_MAPS, 1);
+				xrp_stats_count(stats, XRP_STATS_BOUNCE_BYTES,
+						size);
+			}
 			do_cache = false;
 		}
 
@@ -876,11 +907,13 @@ static long __xrp_share_block(struct file *filp,
 		 __func__, mapping, mapping->type);
 
 	if (do_cache) {
+		start = xrp_stats_now();
 		if (flags & XRP_FLAG_WRITE) {
 			xvp->hw_ops->flush_cache((void *)virt, phys, size);
 		} else if (flags & XRP_FLAG_READ) {
 			xvp->hw_ops->clean_cache((void *)virt, phys, size);
 		}
+		xrp_stats_add(stats, XRP_STATS_MAP_CACHE, start);
 	}
 	return 0;
 }
@@ -1051,8 +1084,49 @@ struct xrp_request {
 		struct xrp_dsp_buffer buffer_data[XRP_DSP_CMD_INLINE_BUFFER_COUNT];
 	};
 	u8 nsid[XRP_DSP_CMD_NAMESPACE_ID_SIZE];
+	struct xrp_request_stats stats;
 };
 
+static inline const void *xrp_request_nsid(const struct xrp_request *rq)
+{
+	return (rq->ioctl_queue.flags & XRP_QUEUE_FLAG_NSID) ? rq->nsid : NULL;
+}
+
+static void xrp_trace_map(struct file *filp, const struct xrp_request *rq,
+			  const struct xrp_mapping *mapping,
+			  unsigned long vaddr, unsigned long size,
+			  phys_addr_t paddr, unsigned long flags)
+{
+	unsigned type;
+
+	if (!trace_xrp_map_enabled())
+		return;
+
+	switch (mapping->type & ~XRP_MAPPING_KERNEL) {
+	case XRP_MAPPING_NATIVE:
+		type = XRP_TRACE_MAP_NATIVE;
+		break;
+	case XRP_MAPPING_ALIEN:
+		switch (mapping->alien_mapping.type) {
+		case ALIEN_GUP:
+			type = XRP_TRACE_MAP_ALIEN_GUP;
+			break;
+		case ALIEN_PFN_MAP:
+			type = XRP_TRACE_MAP_ALIEN_PFN_MAP;
+			break;
+		default:
+			type = XRP_TRACE_MAP_ALIEN_COPY;
+			break;
+		}
+		break;
+	default:
+		type = XRP_TRACE_MAP_KERNEL;
+		break;
+	}
+	trace_xrp_map(filp, xrp_request_nsid(rq), type,
+		      vaddr, size, paddr, flags);
+}
+
 static void xrp_unmap_request_nowb(struct file *filp, struct xrp_request *rq)
 {
 	size_t n_buffers = rq->n_buffers;
@@ -1139,14 +1213,9 @@ static long xrp_map_request(struct file *filp, struct xrp_request *rq,
 
 	size_t i;
 	long ret = 0;
+	u64 t = xrp_stats_now();
 
-	if ((rq->ioctl_queue.flags & XRP_QUEUE_FLAG_NSID) &&
-	    copy_from_user(rq->nsid,
-			   (void __user *)(unsigned long)rq->ioctl_queue.nsid_addr,
-			   sizeof(rq->nsid))) {
-		pr_debug("%s: nsid could not be copied\n ", __func__);
-		return -EINVAL;
-	}
+	xrp_stats_count(&rq->stats, XRP_STATS_BUFFERS, n_buffers);
 	rq->n_buffers = n_buffers;
 	if (n_buffers) {
 		rq->buffer_mapping =
@@ -1168,16 +1237,22 @@ static long xrp_map_request(struct file *filp, struct xrp_request *rq,
 	down_read(&mm->mmap_sem);
 
 	if (rq->ioctl_queue.in_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
+		t = xrp_stats_add(&rq->stats, XRP_STATS_MAP, t);
 		ret = __xrp_share_block(filp, rq->ioctl_queue.in_data_addr,
 					rq->ioctl_queue.in_data_size,
 					XRP_FLAG_READ, &rq->in_data_phys,
-					&rq->in_data_mapping);
+					&rq->in_data_mapping, &rq->stats);
 		if(ret < 0) {
 			pr_debug("%s: in_data could not be shared\n",
 				 __func__);
 			goto share_err;
 		}
+		xrp_trace_map(filp, rq, &rq->in_data_mapping,
+			      rq->ioctl_queue.in_data_addr,
+			      rq->ioctl_queue.in_data_size,
+			      rq->in_data_phys, XRP_FLAG_READ);
 	} else {
+		t = xrp_stats_add(&rq->stats, XRP_STATS_MAP, t);
 		if (copy_from_user(rq->in_data,
 				   (void __user *)(unsigned long)rq->ioctl_queue.in_data_addr,
 				   rq->ioctl_queue.in_data_size)) {
@@ -1186,18 +1261,23 @@ static long xrp_map_request(struct file *filp, struct xrp_request *rq,
 			ret = -EFAULT;
 			goto share_err;
 		}
+		t = xrp_stats_add(&rq->stats, XRP_STATS_COPY_IN, t);
 	}
 
 	if (rq->ioctl_queue.out_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
 		ret = __xrp_share_block(filp, rq->ioctl_queue.out_data_addr,
 					rq->ioctl_queue.out_data_size,
 					XRP_FLAG_WRITE, &rq->out_data_phys,
-					&rq->out_data_mapping);
+					&rq->out_data_mapping, &rq->stats);
 		if (ret < 0) {
 			pr_debug("%s: out_data could not be shared\n",
 				 __func__);
 			goto share_err;
 		}
+		xrp_trace_map(filp, rq, &rq->out_data_mapping,
+			      rq->ioctl_queue.out_data_addr,
+			      rq->ioctl_queue.out_data_size,
+			      rq->out_data_phys, XRP_FLAG_WRITE);
 	}
 
 	buffer = (void __user *)(unsigned long)rq->ioctl_queue.buffer_addr;
@@ -1206,22 +1286,28 @@ static long xrp_map_request(struct file *filp, struct xrp_request *rq,
 		struct xrp_ioctl_buffer ioctl_buffer;
 		phys_addr_t buffer_phys = ~0ul;
 
+		t = xrp_stats_add(&rq->stats, XRP_STATS_MAP, t);
 		if (copy_from_user(&ioctl_buffer, buffer + i,
 				   sizeof(ioctl_buffer))) {
 			ret = -EFAULT;
 			goto share_err;
 		}
+		t = xrp_stats_add(&rq->stats, XRP_STATS_COPY_IN, t);
 		if (ioctl_buffer.flags & XRP_FLAG_READ_WRITE) {
 			ret = __xrp_share_block(filp, ioctl_buffer.addr,
 						ioctl_buffer.size,
 						ioctl_buffer.flags,
 						&buffer_phys,
-						rq->buffer_mapping + i);
+						rq->buffer_mapping + i,
+						&rq->stats);
 			if (ret < 0) {
 				pr_debug("%s: buffer %zd could not be shared\n",
 					 __func__, i);
 				goto share_err;
 			}
+			xrp_trace_map(filp, rq, rq->buffer_mapping + i,
+				      ioctl_buffer.addr, ioctl_buffer.size,
+				      buffer_phys, ioctl_buffer.flags);
 		}
 
 		rq->dsp_buffer[i] = (struct xrp_dsp_buffer){
@@ -1236,17 +1322,22 @@ static long xrp_map_request(struct file *filp, struct xrp_request *rq,
 		ret = xrp_share_kernel(filp, (unsigned long)rq->dsp_buffer,
 				       n_buffers * sizeof(*rq->dsp_buffer),
 				       XRP_FLAG_READ_WRITE, &rq->dsp_buffer_phys,
-				       &rq->dsp_buffer_mapping);
+				       &rq->dsp_buffer_mapping, &rq->stats);
 		if(ret < 0) {
 			pr_debug("%s: buffer descriptors could not be shared\n",
 				 __func__);
 			goto share_err;
 		}
+		xrp_trace_map(filp, rq, &rq->dsp_buffer_mapping,
+			      (unsigned long)rq->dsp_buffer,
+			      n_buffers * sizeof(*rq->dsp_buffer),
+			      rq->dsp_buffer_phys, XRP_FLAG_READ_WRITE);
 	}
 share_err:
 	up_read(&mm->mmap_sem);
 	if (ret < 0)
 		xrp_unmap_request_nowb(filp, rq);
+	xrp_stats_add(&rq->stats, XRP_STATS_MAP, t);
 	return ret;
 }
 
@@ -1310,30 +1401,43 @@ static long xrp_complete_hw_request(struct xrp_dsp_cmd __iomem *cmd,
 	return (flags & XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL) ? -ENXIO : 0;
 }
 
-static long xrp_ioctl_submit_sync(struct file *filp,
-				  struct xrp_ioctl_queue __user *p)
+static long xrp_submit_request(struct file *filp, struct xrp_request *rq)
 {
 	struct xvp_file *xvp_file = filp->private_data;
 	struct xvp *xvp = xvp_file->xvp;
-	struct xrp_request xrp_rq, *rq = &xrp_rq;
+	const void *nsid = NULL;
 	long ret = 0;
 	bool went_off = false;
-
-	if (copy_from_user(&rq->ioctl_queue, p, sizeof(*p)))
-		return -EFAULT;
+	u64 t = xrp_stats_now();
 
 	if (rq->ioctl_queue.flags & ~XRP_QUEUE_VALID_FLAGS) {
 		dev_dbg(xvp->dev, "%s: invalid flags 0x%08x\n",
 			__func__, rq->ioctl_queue.flags);
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (rq->ioctl_queue.flags & XRP_QUEUE_FLAG_NSID) {
+		if (copy_from_user(rq->nsid,
+				   (void __user *)(unsigned long)rq->ioctl_queue.nsid_addr,
+				   sizeof(rq->nsid))) {
+			pr_debug("%s: nsid could not be copied\n ", __func__);
+			ret = -EINVAL;
+			goto out;
+		}
+		nsid = rq->nsid;
 	}
+	xrp_stats_add(&rq->stats, XRP_STATS_COPY_IN, t);
+	trace_xrp_submit(xvp, filp, nsid, &rq->ioctl_queue);
 
 	ret = xrp_map_request(filp, rq, current->mm);
 	if (ret < 0)
-		return ret;
+		goto out;
 
+	t = xrp_stats_now();
 	if (loopback < LOOPBACK_NOIO) {
 		mutex_lock(&xvp->comm_lock);
+		t = xrp_stats_add(&rq->stats, XRP_STATS_LOCK, t);
 
 		if (xvp->off) {
 			ret = -ENODEV;
@@ -1341,6 +1445,10 @@ static long xrp_ioctl_submit_sync(struct file *filp,
 			xrp_fill_hw_request(xvp->comm, rq, &xvp->address_map);
 
 			xrp_send_device_irq(xvp);
+			t = xrp_stats_add(&rq->stats, XRP_STATS_FILL, t);
+			trace_xrp_fill(xvp, filp, nsid,
+				       rq->ioctl_queue.in_data_size,
+				       rq->n_buffers);
 
 			if (xvp->host_irq_mode) {
 				ret = xvp_complete_cmd_irq(&xvp->completion,
@@ -1350,6 +1458,9 @@ static long xrp_ioctl_submit_sync(struct file *filp,
 				ret = xvp_complete_cmd_poll(xrp_cmd_complete,
 							    xvp);
 			}
+			t = xrp_stats_complete(xvp, &rq->stats, t);
+			trace_xrp_complete(xvp, filp, nsid,
+					   rq->ioctl_queue.out_data_size, ret);
 
 			/* copy back inline data */
 			if (ret == 0) {
@@ -1361,6 +1472,7 @@ static long xrp_ioctl_submit_sync(struct file *filp,
 					"%s: restarting firmware...\n",
 					 __func__);
 				rc = xrp_boot_firmware(xvp);
+				trace_xrp_reboot(xvp, rc);
 				if (rc < 0) {
 					ret = rc;
 					went_off = xvp->off;
@@ -1381,6 +1493,63 @@ static long xrp_ioctl_submit_sync(struct file *filp,
 	 * this memory.
 	 */
 
+	xrp_stats_add(&rq->stats, XRP_STATS_UNMAP, t);
+	trace_xrp_unmap(filp, nsid, rq->ioctl_queue.out_data_size,
+			rq->ioctl_queue.buffer_size /
+			sizeof(struct xrp_ioctl_buffer), ret);
+out:
+	xrp_stats_commit(xvp, nsid, &rq->stats, ret);
+	return ret;
+}
+
+static long xrp_ioctl_submit_sync(struct file *filp,
+				  struct xrp_ioctl_queue __user *p)
+{
+	struct xrp_request xrp_rq, *rq = &xrp_rq;
+	u64 t = xrp_stats_start(&rq->stats);
+
+	if (copy_from_user(&rq->ioctl_queue, p, sizeof(*p)))
+		return -EFAULT;
+
+	xrp_stats_add(&rq->stats, XRP_STATS_COPY_IN, t);
+	return xrp_submit_request(filp, rq);
+}
+
+static long xrp_ioctl_submit_batch(struct file *filp,
+				   struct xrp_ioctl_queue_batch __user *p)
+{
+	struct xrp_ioctl_queue_batch batch;
+	struct xrp_ioctl_queue __user *queue;
+	struct xrp_request xrp_rq, *rq = &xrp_rq;
+	long ret = 0;
+	__u32 i;
+
+	if (copy_from_user(&batch, p, sizeof(*p)))
+		return -EFAULT;
+
+	queue = (void __user *)(unsigned long)batch.queue_addr;
+
+	for (i = 0; i < batch.n_queue; ++i) {
+		u64 t = xrp_stats_start(&rq->stats);
+
+		if (copy_from_user(&rq->ioctl_queue, queue + i,
+				   sizeof(rq->ioctl_queue))) {
+			ret = -EFAULT;
+			break;
+		}
+		xrp_stats_add(&rq->stats, XRP_STATS_COPY_IN, t);
+		ret = xrp_submit_request(filp, rq);
+		if (ret < 0)
+			break;
+	}
+
+	/*
+	 * Let the user know how many commands were executed, so that
+	 * it could tell a failed command from a missing batch support.
+	 */
+	if (put_user(i, &p->n_done))
+		return -EFAULT;
+
 	return ret;
 }
 
@@ -1407,6 +1576,11 @@ static long xvp_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 					       (struct xrp_ioctl_queue __user *)arg);
 		break;
 
+	case XRP_IOCTL_QUEUE_BATCH:
+		retval = xrp_ioctl_submit_batch(filp,
+						(struct xrp_ioctl_queue_batch __user *)arg);
+		break;
+
 	default:
 		retval = -EINVAL;
 		break;
@@ -1735,6 +1909,8 @@ static int xrp_init_common(struct platform_device *pdev, struct xvp *xvp,
 	ret = misc_register(&xvp->miscdev);
 	if (ret < 0)
 		goto err_pm_disable;
+
+	xrp_debugfs_init(xvp);
 	return 0;
 err_pm_disable:
 	pm_runtime_disable(xvp->dev);
@@ -1780,6 +1956,7 @@ int xrp_deinit(struct platform_device *pdev)
 	if (!pm_runtime_status_suspended(xvp->dev))
 		xrp_runtime_suspend(xvp->dev);
 
+	xrp_debugfs_deinit(xvp);
 	misc_deregister(&xvp->miscdev);
 	release_firmware(xvp->firmware);
 	xrp_free_pool(xvp->pool);
@@ -1909,7 +2086,24 @@ static struct platform_driver xrp_driver = {
 	},
 };
 
-module_platform_driver(xrp_driver);
+static int __init xrp_module_init(void)
+{
+	int ret;
+
+	xrp_debugfs_module_init();
+	ret = platform_driver_register(&xrp_driver);
+	if (ret < 0)
+		xrp_debugfs_module_exit();
+	return ret;
+}
+module_init(xrp_module_init);
+
+static void __exit xrp_module_exit(void)
+{
+	platform_driver_unregister(&xrp_driver);
+	xrp_debugfs_module_exit();
+}
+module_exit(xrp_module_exit);
 
 MODULE_AUTHOR("Takayuki Sugawara");
 MODULE_AUTHOR("Max Filippov");
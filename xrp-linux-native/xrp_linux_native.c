@@ -39,6 +39,7 @@ typedef uint64_t __u64;
 
 #include "xrp_api.h"
 #include "xrp_kernel_defs.h"
+#include "xrp_native_heap.h"
 
 #if defined(__STDC_NO_ATOMICS__)
 #warning The compiler does not support atomics, reference counting may not be thread safe
@@ -52,6 +53,7 @@ struct xrp_refcounted {
 struct xrp_device {
 	struct xrp_refcounted ref;
 	int fd;
+	struct xrp_heap *heap;
 };
 
 struct xrp_buffer {
@@ -61,6 +63,8 @@ struct xrp_buffer {
 		XRP_BUFFER_TYPE_HOST,
 		XRP_BUFFER_TYPE_DEVICE,
 	} type;
+	struct xrp_buffer *parent;
+	struct xrp_heap *heap;
 	void *ptr;
 	size_t size;
 	_Atomic unsigned long map_count;
@@ -78,6 +82,8 @@ struct xrp_buffer_group {
 	size_t n_buffers;
 	size_t capacity;
 	struct xrp_buffer_group_record *buffer;
+	_Atomic int sealed;
+	struct xrp_ioctl_buffer *ioctl_buffer;
 };
 
 struct xrp_request {
@@ -88,7 +94,10 @@ struct xrp_request {
 	size_t in_data_size;
 	size_t out_data_size;
 	struct xrp_buffer_group *buffer_group;
+	struct xrp_command_list *command_list;
 	struct xrp_event *event;
+	size_t n_wait_events;
+	struct xrp_event **wait_event;
 };
 
 struct xrp_queue {
@@ -116,6 +125,25 @@ struct xrp_event {
 	_Atomic enum xrp_status status;
 };
 
+struct xrp_command_list_record {
+	void *in_data;
+	size_t in_data_size;
+	size_t n_buffers;
+	struct xrp_buffer **buffer;
+	struct xrp_ioctl_buffer *ioctl_buffer;
+};
+
+struct xrp_command_list {
+	struct xrp_refcounted ref;
+	struct xrp_queue *queue;
+	pthread_mutex_t mutex;
+	size_t n_commands;
+	size_t capacity;
+	struct xrp_command_list_record *command;
+	struct xrp_ioctl_queue *ioctl_queue;
+	_Atomic int queued;
+};
+
 /* Helpers */
 
 static inline void set_status(enum xrp_status *status, enum xrp_status v)
@@ -186,6 +214,7 @@ struct xrp_device *xrp_open_device(int idx, enum xrp_status *status)
 		return NULL;
 	}
 	device->fd = fd;
+	device->heap = xrp_heap_create(fd);
 	set_status(status, XRP_STATUS_SUCCESS);
 	return device;
 }
@@ -198,6 +227,8 @@ void xrp_retain_device(struct xrp_device *device, enum xrp_status *status)
 void xrp_release_device(struct xrp_device *device, enum xrp_status *status)
 {
 	if (last_refcount(device)) {
+		if (device->heap)
+			xrp_heap_destroy(device->heap);
 		if (close(device->fd) == -1) {
 			set_status(status, XRP_STATUS_FAILURE);
 			return;
@@ -207,6 +238,44 @@ void xrp_release_device(struct xrp_device *device, enum xrp_status *status)
 }
 
 
+/* Host memory API. */
+
+/*
+ * Memory allocated by the driver is mapped into the process, requests
+ * that reference it are resolved to its physical address by the driver.
+ */
+void *xrp_host_alloc(struct xrp_device *device, size_t size,
+		     enum xrp_status *status)
+{
+	struct xrp_ioctl_alloc ioctl_alloc = {
+		.size = size,
+	};
+	int ret = ioctl(device->fd, XRP_IOCTL_ALLOC, &ioctl_alloc);
+
+	if (ret < 0) {
+		xrp_heap_trim(device->heap);
+		ret = ioctl(device->fd, XRP_IOCTL_ALLOC, &ioctl_alloc);
+	}
+	if (ret < 0) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+	set_status(status, XRP_STATUS_SUCCESS);
+	return (void *)(uintptr_t)ioctl_alloc.addr;
+}
+
+void xrp_host_free(struct xrp_device *device, void *p,
+		   enum xrp_status *status)
+{
+	struct xrp_ioctl_alloc ioctl_alloc = {
+		.addr = (uintptr_t)p,
+	};
+	int ret = ioctl(device->fd, XRP_IOCTL_FREE, &ioctl_alloc);
+
+	set_status(status, ret < 0 ? XRP_STATUS_FAILURE : XRP_STATUS_SUCCESS);
+}
+
+
 /* Buffer API. */
 
 struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
@@ -241,16 +310,33 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 			return NULL;
 		}
 		buf->device = device;
+		buf->type = XRP_BUFFER_TYPE_DEVICE;
+		buf->size = size;
+
+		buf->ptr = xrp_heap_alloc(device->heap, size);
+		if (buf->ptr) {
+			buf->heap = device->heap;
+			set_status(status, XRP_STATUS_SUCCESS);
+			return buf;
+		}
+
 		ret = ioctl(buf->device->fd, XRP_IOCTL_ALLOC, &ioctl_alloc);
+		if (ret < 0) {
+			/*
+			 * Memory may be held in unused heap arenas,
+			 * give it back and retry.
+			 */
+			xrp_heap_trim(device->heap);
+			ret = ioctl(buf->device->fd, XRP_IOCTL_ALLOC,
+				    &ioctl_alloc);
+		}
 		if (ret < 0) {
 			xrp_release_device(buf->device, NULL);
 			release_refcounted(buf);
 			set_status(status, XRP_STATUS_FAILURE);
 			return NULL;
 		}
-		buf->type = XRP_BUFFER_TYPE_DEVICE;
 		buf->ptr = (void *)(uintptr_t)ioctl_alloc.addr;
-		buf->size = size;
 	} else {
 		buf->type = XRP_BUFFER_TYPE_HOST;
 		buf->ptr = host_ptr;
@@ -260,6 +346,34 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 	return buf;
 }
 
+struct xrp_buffer *xrp_create_sub_buffer(struct xrp_buffer *parent,
+					 size_t offset, size_t size,
+					 enum xrp_status *status)
+{
+	struct xrp_buffer *buf;
+
+	if (offset > parent->size || size > parent->size - offset) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	buf = alloc_refcounted(sizeof(*buf));
+
+	if (!buf) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	xrp_retain_buffer(parent, NULL);
+	buf->parent = parent;
+	buf->device = parent->device;
+	buf->type = parent->type;
+	buf->ptr = (char *)parent->ptr + offset;
+	buf->size = size;
+	set_status(status, XRP_STATUS_SUCCESS);
+	return buf;
+}
+
 void xrp_retain_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 {
 	set_status(status, retain_refcounted(buffer));
@@ -268,7 +382,12 @@ void xrp_retain_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 void xrp_release_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 {
 	if (last_refcount(buffer)) {
-		if (buffer->type == XRP_BUFFER_TYPE_DEVICE) {
+		if (buffer->parent) {
+			xrp_release_buffer(buffer->parent, NULL);
+		} else if (buffer->heap) {
+			xrp_heap_free(buffer->heap, buffer->ptr, buffer->size);
+			xrp_release_device(buffer->device, NULL);
+		} else if (buffer->type == XRP_BUFFER_TYPE_DEVICE) {
 			enum xrp_status s;
 			struct xrp_ioctl_alloc ioctl_alloc = {
 				.addr = (uintptr_t)buffer->ptr,
@@ -383,6 +502,7 @@ void xrp_release_buffer_group(struct xrp_buffer_group *group,
 		pthread_mutex_unlock(&group->mutex);
 		pthread_mutex_destroy(&group->mutex);
 		free(group->buffer);
+		free(group->ioctl_buffer);
 	}
 	set_status(status, release_refcounted(group));
 }
@@ -396,6 +516,11 @@ size_t xrp_add_buffer_to_group(struct xrp_buffer_group *group,
 	size_t n_buffers;
 
 	pthread_mutex_lock(&group->mutex);
+	if (group->sealed) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
 	if (group->n_buffers == group->capacity) {
 		struct xrp_buffer_group_record *r =
 			realloc(group->buffer,
@@ -439,7 +564,7 @@ void xrp_set_buffer_in_group(struct xrp_buffer_group *group,
 		struct xrp_buffer *old_buffer;
 
 		pthread_mutex_lock(&group->mutex);
-		if (index < group->n_buffers) {
+		if (index < group->n_buffers && !group->sealed) {
 			old_buffer = group->buffer[index].buffer;
 			group->buffer[index].buffer = buffer;
 			group->buffer[index].access_flags = access_flags;
@@ -508,6 +633,38 @@ out:
 }
 
 
+void xrp_seal_buffer_group(struct xrp_buffer_group *group,
+			   enum xrp_status *status)
+{
+	struct xrp_ioctl_buffer *ioctl_buffer;
+	size_t i;
+
+	pthread_mutex_lock(&group->mutex);
+	if (group->sealed) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_SUCCESS);
+		return;
+	}
+	ioctl_buffer = malloc(group->n_buffers * sizeof(*ioctl_buffer));
+	if (group->n_buffers && !ioctl_buffer) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	for (i = 0; i < group->n_buffers; ++i) {
+		ioctl_buffer[i] = (struct xrp_ioctl_buffer){
+			.flags = group->buffer[i].access_flags,
+			.size = group->buffer[i].buffer->size,
+			.addr = (uintptr_t)group->buffer[i].buffer->ptr,
+		};
+	}
+	group->ioctl_buffer = ioctl_buffer;
+	group->sealed = 1;
+	pthread_mutex_unlock(&group->mutex);
+	set_status(status, XRP_STATUS_SUCCESS);
+}
+
+
 /* Queue API. */
 
 static int xrp_queue_process(struct xrp_queue *queue);
@@ -628,6 +785,28 @@ static struct xrp_request *_xrp_dequeue_request(struct xrp_queue *queue)
 	return rq;
 }
 
+static int _xrp_ioctl_queue(struct xrp_queue *queue,
+			    const void *in_data, size_t in_data_size,
+			    void *out_data, size_t out_data_size,
+			    const struct xrp_ioctl_buffer *ioctl_buffer,
+			    size_t n_buffers)
+{
+	struct xrp_ioctl_queue ioctl_queue = {
+		.flags = (queue->use_nsid ? XRP_QUEUE_FLAG_NSID : 0),
+		.in_data_size = in_data_size,
+		.out_data_size = out_data_size,
+		.buffer_size = n_buffers *
+			sizeof(struct xrp_ioctl_buffer),
+		.in_data_addr = (uintptr_t)in_data,
+		.out_data_addr = (uintptr_t)out_data,
+		.buffer_addr = (uintptr_t)ioctl_buffer,
+		.nsid_addr = (uintptr_t)queue->nsid,
+	};
+
+	return ioctl(queue->device->fd,
+		     XRP_IOCTL_QUEUE, &ioctl_queue);
+}
+
 static void _xrp_run_command(struct xrp_queue *queue,
 			     const void *in_data, size_t in_data_size,
 			     void *out_data, size_t out_data_size,
@@ -636,42 +815,76 @@ static void _xrp_run_command(struct xrp_queue *queue,
 {
 	int ret;
 
-	if (buffer_group)
-		pthread_mutex_lock(&buffer_group->mutex);
-	{
-		size_t n_buffers = buffer_group ? buffer_group->n_buffers : 0;
-		struct xrp_ioctl_buffer ioctl_buffer[n_buffers];/* TODO */
-		struct xrp_ioctl_queue ioctl_queue = {
-			.flags = (queue->use_nsid ? XRP_QUEUE_FLAG_NSID : 0),
-			.in_data_size = in_data_size,
-			.out_data_size = out_data_size,
-			.buffer_size = n_buffers *
-				sizeof(struct xrp_ioctl_buffer),
-			.in_data_addr = (uintptr_t)in_data,
-			.out_data_addr = (uintptr_t)out_data,
-			.buffer_addr = (uintptr_t)ioctl_buffer,
-			.nsid_addr = (uintptr_t)queue->nsid,
-		};
-		size_t i;
-
-		for (i = 0; i < n_buffers; ++i) {
-			if (buffer_group->buffer[i].buffer->map_count > 0) {
+	if (buffer_group && buffer_group->sealed) {
+		/*
+		 * Sealed group cannot change, its buffer descriptors are
+		 * prepared by xrp_seal_buffer_group.
+		 */
+		ret = _xrp_ioctl_queue(queue,
+				       in_data, in_data_size,
+				       out_data, out_data_size,
+				       buffer_group->ioctl_buffer,
+				       buffer_group->n_buffers);
+	} else {
+		if (buffer_group)
+			pthread_mutex_lock(&buffer_group->mutex);
+		{
+			size_t n_buffers = buffer_group ? buffer_group->n_buffers : 0;
+			struct xrp_ioctl_buffer ioctl_buffer[n_buffers];/* TODO */
+			size_t i;
+
+			for (i = 0; i < n_buffers; ++i) {
+				if (buffer_group->buffer[i].buffer->map_count > 0) {
+					pthread_mutex_unlock(&buffer_group->mutex);
+					set_status(status, XRP_STATUS_FAILURE);
+					return;
+
+				}
+				ioctl_buffer[i] = (struct xrp_ioctl_buffer){
+					.flags = buffer_group->buffer[i].access_flags,
+					.size = buffer_group->buffer[i].buffer->size,
+					.addr = (uintptr_t)buffer_group->buffer[i].buffer->ptr,
+				};
+			}
+			if (buffer_group)
 				pthread_mutex_unlock(&buffer_group->mutex);
-				set_status(status, XRP_STATUS_FAILURE);
-				return;
 
-			}
-			ioctl_buffer[i] = (struct xrp_ioctl_buffer){
-				.flags = buffer_group->buffer[i].access_flags,
-				.size = buffer_group->buffer[i].buffer->size,
-				.addr = (uintptr_t)buffer_group->buffer[i].buffer->ptr,
-			};
+			ret = _xrp_ioctl_queue(queue,
+					       in_data, in_data_size,
+					       out_data, out_data_size,
+					       ioctl_buffer, n_buffers);
 		}
-		if (buffer_group)
-			pthread_mutex_unlock(&buffer_group->mutex);
+	}
+
+	if (ret < 0)
+		set_status(status, XRP_STATUS_FAILURE);
+	else
+		set_status(status, XRP_STATUS_SUCCESS);
+}
+
+static void _xrp_run_command_list(struct xrp_queue *queue,
+				  struct xrp_command_list *list,
+				  enum xrp_status *status)
+{
+	struct xrp_ioctl_queue_batch batch = {
+		.n_queue = list->n_commands,
+		.n_done = (__u32)-1,
+		.queue_addr = (uintptr_t)list->ioctl_queue,
+	};
+	int ret;
 
-		ret = ioctl(queue->device->fd,
-			    XRP_IOCTL_QUEUE, &ioctl_queue);
+	ret = ioctl(queue->device->fd, XRP_IOCTL_QUEUE_BATCH, &batch);
+
+	/*
+	 * Driver without batch support does not update n_done,
+	 * submit commands one by one in that case.
+	 */
+	if (ret < 0 && batch.n_done == (__u32)-1) {
+		size_t i;
+
+		for (i = 0, ret = 0; i < list->n_commands && ret >= 0; ++i)
+			ret = ioctl(queue->device->fd,
+				    XRP_IOCTL_QUEUE, list->ioctl_queue + i);
 	}
 
 	if (ret < 0)
@@ -680,6 +893,23 @@ static void _xrp_run_command(struct xrp_queue *queue,
 		set_status(status, XRP_STATUS_SUCCESS);
 }
 
+static enum xrp_status xrp_wait_request_events(struct xrp_request *rq)
+{
+	enum xrp_status s = XRP_STATUS_SUCCESS;
+	size_t i;
+
+	for (i = 0; i < rq->n_wait_events; ++i) {
+		struct xrp_event *event = rq->wait_event[i];
+
+		xrp_wait(event, NULL);
+		if (event->status != XRP_STATUS_SUCCESS)
+			s = XRP_STATUS_FAILURE;
+		xrp_release_event(event, NULL);
+	}
+	free(rq->wait_event);
+	return s;
+}
+
 static int xrp_queue_process(struct xrp_queue *queue)
 {
 	struct xrp_request *rq;
@@ -700,15 +930,28 @@ static int xrp_queue_process(struct xrp_queue *queue)
 	if (!rq)
 		return 0;
 
-	_xrp_run_command(queue,
-			 rq->in_data, rq->in_data_size,
-			 rq->out_data, rq->out_data_size,
-			 rq->buffer_group,
-			 &status);
+	/*
+	 * Commands that depend on failed commands are not run.
+	 */
+	if (xrp_wait_request_events(rq) != XRP_STATUS_SUCCESS)
+		status = XRP_STATUS_FAILURE;
+	else if (rq->command_list)
+		_xrp_run_command_list(queue, rq->command_list, &status);
+	else
+		_xrp_run_command(queue,
+				 rq->in_data, rq->in_data_size,
+				 rq->out_data, rq->out_data_size,
+				 rq->buffer_group,
+				 &status);
 
 	if (rq->buffer_group)
 		xrp_release_buffer_group(rq->buffer_group, NULL);
 
+	if (rq->command_list) {
+		rq->command_list->queued = 0;
+		xrp_release_command_list(rq->command_list, NULL);
+	}
+
 	if (rq->event) {
 		struct xrp_event *event = rq->event;
 		pthread_mutex_lock(&event->mutex);
@@ -751,6 +994,31 @@ void xrp_event_status(struct xrp_event *event, enum xrp_status *status)
 	set_status(status, event->status);
 }
 
+static struct xrp_event *xrp_create_event(struct xrp_queue *queue,
+					  enum xrp_status *status)
+{
+	struct xrp_event *event;
+	enum xrp_status s;
+
+	event = alloc_refcounted(sizeof(*event));
+	if (!event) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+	xrp_retain_queue(queue, &s);
+	if (s != XRP_STATUS_SUCCESS) {
+		set_status(status, s);
+		release_refcounted(event);
+		return NULL;
+	}
+	event->queue = queue;
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->status = XRP_STATUS_PENDING;
+	set_status(status, XRP_STATUS_SUCCESS);
+	return event;
+}
+
 /* Communication API */
 
 void xrp_run_command_sync(struct xrp_queue *queue,
@@ -780,15 +1048,34 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 			 struct xrp_buffer_group *buffer_group,
 			 struct xrp_event **evt,
 			 enum xrp_status *status)
+{
+	xrp_enqueue_command_after(queue, in_data, in_data_size,
+				  out_data, out_data_size,
+				  buffer_group, NULL, 0, evt, status);
+}
+
+void xrp_enqueue_command_after(struct xrp_queue *queue,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       struct xrp_event *const *wait_event,
+			       size_t n_wait_events,
+			       struct xrp_event **evt,
+			       enum xrp_status *status)
 {
 	struct xrp_request *rq;
 	void *in_data_copy;
+	struct xrp_event **wait_event_copy;
 	struct xrp_event *event = NULL;
+	size_t i;
 
 	rq = malloc(sizeof(*rq));
 	in_data_copy = malloc(in_data_size);
+	wait_event_copy = malloc(n_wait_events * sizeof(*wait_event_copy));
 
-	if (!rq || (in_data_size && !in_data_copy)) {
+	if (!rq || (in_data_size && !in_data_copy) ||
+	    (n_wait_events && !wait_event_copy)) {
+		free(wait_event_copy);
 		free(in_data_copy);
 		free(rq);
 		set_status(status, XRP_STATUS_FAILURE);
@@ -804,25 +1091,14 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	if (evt) {
 		enum xrp_status s;
 
-		event = alloc_refcounted(sizeof(*event));
-		if (!event) {
-			free(rq->in_data);
-			free(rq);
-			set_status(status, XRP_STATUS_FAILURE);
-			return;
-		}
-		xrp_retain_queue(queue, &s);
+		event = xrp_create_event(queue, &s);
 		if (s != XRP_STATUS_SUCCESS) {
+			free(wait_event_copy);
 			free(rq->in_data);
 			free(rq);
 			set_status(status, s);
-			release_refcounted(event);
 			return;
 		}
-		event->queue = queue;
-		pthread_mutex_init(&event->mutex, NULL);
-		pthread_cond_init(&event->cond, NULL);
-		event->status = XRP_STATUS_PENDING;
 		*evt = event;
 		xrp_retain_event(event, NULL);
 		rq->event = event;
@@ -833,6 +1109,14 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	if (buffer_group)
 		xrp_retain_buffer_group(buffer_group, NULL);
 	rq->buffer_group = buffer_group;
+	rq->command_list = NULL;
+
+	for (i = 0; i < n_wait_events; ++i) {
+		xrp_retain_event(wait_event[i], NULL);
+		wait_event_copy[i] = wait_event[i];
+	}
+	rq->n_wait_events = n_wait_events;
+	rq->wait_event = wait_event_copy;
 
 	xrp_enqueue_request(queue, rq);
 
@@ -847,3 +1131,241 @@ void xrp_wait(struct xrp_event *event, enum xrp_status *status)
 	pthread_mutex_unlock(&event->mutex);
 	set_status(status, XRP_STATUS_SUCCESS);
 }
+
+
+/* Command list API. */
+
+struct xrp_command_list *xrp_create_command_list(struct xrp_queue *queue,
+						 enum xrp_status *status)
+{
+	struct xrp_command_list *list;
+	enum xrp_status s;
+
+	if (!queue) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	list = alloc_refcounted(sizeof(*list));
+	if (!list) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	xrp_retain_queue(queue, &s);
+	if (s != XRP_STATUS_SUCCESS) {
+		set_status(status, s);
+		release_refcounted(list);
+		return NULL;
+	}
+	list->queue = queue;
+	pthread_mutex_init(&list->mutex, NULL);
+	set_status(status, XRP_STATUS_SUCCESS);
+	return list;
+}
+
+void xrp_retain_command_list(struct xrp_command_list *list,
+			     enum xrp_status *status)
+{
+	set_status(status, retain_refcounted(list));
+}
+
+void xrp_release_command_list(struct xrp_command_list *list,
+			      enum xrp_status *status)
+{
+	if (last_refcount(list)) {
+		enum xrp_status s;
+		size_t i, j;
+
+		for (i = 0; i < list->n_commands; ++i) {
+			struct xrp_command_list_record *command =
+				list->command + i;
+
+			for (j = 0; j < command->n_buffers; ++j)
+				xrp_release_buffer(command->buffer[j], NULL);
+			free(command->buffer);
+			free(command->ioctl_buffer);
+			free(command->in_data);
+		}
+		free(list->command);
+		free(list->ioctl_queue);
+		pthread_mutex_destroy(&list->mutex);
+		xrp_release_queue(list->queue, &s);
+		if (s != XRP_STATUS_SUCCESS) {
+			set_status(status, s);
+			return;
+		}
+	}
+	set_status(status, release_refcounted(list));
+}
+
+static int xrp_command_list_reserve(struct xrp_command_list *list)
+{
+	size_t capacity = (list->capacity + 2) * 2;
+	struct xrp_command_list_record *command;
+	struct xrp_ioctl_queue *ioctl_queue;
+
+	if (list->n_commands < list->capacity)
+		return 1;
+
+	command = realloc(list->command, capacity * sizeof(*command));
+	if (!command)
+		return 0;
+	list->command = command;
+
+	ioctl_queue = realloc(list->ioctl_queue,
+			      capacity * sizeof(*ioctl_queue));
+	if (!ioctl_queue)
+		return 0;
+	list->ioctl_queue = ioctl_queue;
+
+	list->capacity = capacity;
+	return 1;
+}
+
+size_t xrp_add_command_to_list(struct xrp_command_list *list,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       enum xrp_status *status)
+{
+	struct xrp_command_list_record command = {
+		.in_data_size = in_data_size,
+	};
+	struct xrp_queue *queue = list->queue;
+	size_t idx;
+	size_t i;
+
+	command.in_data = malloc(in_data_size);
+	if (in_data_size && !command.in_data) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
+	memcpy(command.in_data, in_data, in_data_size);
+
+	if (buffer_group) {
+		pthread_mutex_lock(&buffer_group->mutex);
+		command.n_buffers = buffer_group->n_buffers;
+		command.buffer = malloc(command.n_buffers *
+					sizeof(*command.buffer));
+		command.ioctl_buffer = malloc(command.n_buffers *
+					      sizeof(*command.ioctl_buffer));
+		if (command.n_buffers &&
+		    (!command.buffer || !command.ioctl_buffer)) {
+			pthread_mutex_unlock(&buffer_group->mutex);
+			free(command.buffer);
+			free(command.ioctl_buffer);
+			free(command.in_data);
+			set_status(status, XRP_STATUS_FAILURE);
+			return -1;
+		}
+		for (i = 0; i < command.n_buffers; ++i) {
+			struct xrp_buffer *buffer = buffer_group->buffer[i].buffer;
+
+			xrp_retain_buffer(buffer, NULL);
+			command.buffer[i] = buffer;
+			command.ioctl_buffer[i] = (struct xrp_ioctl_buffer){
+				.flags = buffer_group->buffer[i].access_flags,
+				.size = buffer->size,
+				.addr = (uintptr_t)buffer->ptr,
+			};
+		}
+		pthread_mutex_unlock(&buffer_group->mutex);
+	}
+
+	pthread_mutex_lock(&list->mutex);
+	if (list->queued || !xrp_command_list_reserve(list)) {
+		pthread_mutex_unlock(&list->mutex);
+		for (i = 0; i < command.n_buffers; ++i)
+			xrp_release_buffer(command.buffer[i], NULL);
+		free(command.buffer);
+		free(command.ioctl_buffer);
+		free(command.in_data);
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
+	idx = list->n_commands++;
+	list->command[idx] = command;
+	list->ioctl_queue[idx] = (struct xrp_ioctl_queue){
+		.flags = (queue->use_nsid ? XRP_QUEUE_FLAG_NSID : 0),
+		.in_data_size = in_data_size,
+		.out_data_size = out_data_size,
+		.buffer_size = command.n_buffers *
+			sizeof(struct xrp_ioctl_buffer),
+		.in_data_addr = (uintptr_t)command.in_data,
+		.out_data_addr = (uintptr_t)out_data,
+		.buffer_addr = (uintptr_t)command.ioctl_buffer,
+		.nsid_addr = (uintptr_t)queue->nsid,
+	};
+	pthread_mutex_unlock(&list->mutex);
+	set_status(status, XRP_STATUS_SUCCESS);
+	return idx;
+}
+
+void xrp_set_command_in_data(struct xrp_command_list *list,
+			     size_t index, size_t offset,
+			     const void *data, size_t size,
+			     enum xrp_status *status)
+{
+	enum xrp_status s = XRP_STATUS_FAILURE;
+
+	pthread_mutex_lock(&list->mutex);
+	if (!list->queued && index < list->n_commands &&
+	    offset <= list->command[index].in_data_size &&
+	    size <= list->command[index].in_data_size - offset) {
+		memcpy((char *)list->command[index].in_data + offset,
+		       data, size);
+		s = XRP_STATUS_SUCCESS;
+	}
+	pthread_mutex_unlock(&list->mutex);
+	set_status(status, s);
+}
+
+void xrp_enqueue_command_list(struct xrp_command_list *list,
+			      struct xrp_event **evt,
+			      enum xrp_status *status)
+{
+	struct xrp_queue *queue = list->queue;
+	struct xrp_request *rq;
+	struct xrp_event *event = NULL;
+	enum xrp_status s;
+
+	rq = calloc(1, sizeof(*rq));
+	if (!rq) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+
+	if (evt) {
+		event = xrp_create_event(queue, &s);
+		if (s != XRP_STATUS_SUCCESS) {
+			free(rq);
+			set_status(status, s);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&list->mutex);
+	if (list->queued) {
+		pthread_mutex_unlock(&list->mutex);
+		if (event)
+			xrp_release_event(event, NULL);
+		free(rq);
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	list->queued = 1;
+	pthread_mutex_unlock(&list->mutex);
+
+	xrp_retain_command_list(list, NULL);
+	rq->command_list = list;
+	if (event) {
+		*evt = event;
+		xrp_retain_event(event, NULL);
+		rq->event = event;
+	}
+
+	xrp_enqueue_request(queue, rq);
+
+	set_status(status, XRP_STATUS_SUCCESS);
+}
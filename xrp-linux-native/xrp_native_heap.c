@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Device memory heap for the native XRP library.
+ *
+ * Every XRP_IOCTL_ALLOC is a syscall, a kernel allocation and a new VMA.
+ * To avoid that for small buffers memory is reserved from the device in
+ * big arenas and split into power-of-two size classes here. An arena holds
+ * objects of a single size class at a time; it can be reused for another
+ * size class once all its objects are freed.
+ *
+ * Each thread has a small cache of free objects per heap and size class,
+ * so that most allocations and frees don't take the heap lock.
+ *
+ * Arenas that become completely free are kept for reuse as long as their
+ * total size stays below the high water mark, the rest is given back to
+ * the device.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#ifndef _UAPI_ASM_GENERIC_INT_LL64_H
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+#endif
+
+#include "xrp_kernel_defs.h"
+#include "xrp_native_heap.h"
+
+#if defined(__STDC_NO_ATOMICS__)
+#warning The compiler does not support atomics, reference counting may not be thread safe
+#define _Atomic
+#endif
+
+#define XRP_HEAP_MIN_SHIFT	6
+#define XRP_HEAP_MAX_SHIFT	16
+#define XRP_HEAP_N_CLASSES	(XRP_HEAP_MAX_SHIFT - XRP_HEAP_MIN_SHIFT + 1)
+#define XRP_HEAP_ARENA_SIZE	(1ul << 20)
+#define XRP_HEAP_MAX_OBJECTS	(XRP_HEAP_ARENA_SIZE >> XRP_HEAP_MIN_SHIFT)
+#define XRP_HEAP_CACHE_SIZE	16
+#define XRP_HEAP_HIGH_WATER	(4 * XRP_HEAP_ARENA_SIZE)
+
+struct xrp_heap_arena {
+	struct xrp_heap_arena *next;
+	char *ptr;
+	unsigned cls;
+	size_t n_objects;
+	size_t n_used;
+	size_t n_bump;
+	size_t n_free;
+	uint32_t free_idx[XRP_HEAP_MAX_OBJECTS];
+};
+
+struct xrp_heap {
+	pthread_mutex_t mutex;
+	_Atomic unsigned long ref;
+	_Atomic int dead;
+	int fd;
+
+	/* arenas sorted by address, for lookup on free */
+	size_t n_arenas;
+	size_t capacity;
+	struct xrp_heap_arena **arena;
+
+	/* arenas in use, per size class */
+	struct xrp_heap_arena *class_arena[XRP_HEAP_N_CLASSES];
+	/* completely free arenas */
+	struct xrp_heap_arena *empty_arena;
+	size_t empty_size;
+};
+
+struct xrp_heap_cache {
+	struct xrp_heap_cache *next;
+	struct xrp_heap *heap;
+	size_t n[XRP_HEAP_N_CLASSES];
+	void *ptr[XRP_HEAP_N_CLASSES][XRP_HEAP_CACHE_SIZE];
+};
+
+static pthread_once_t xrp_heap_once = PTHREAD_ONCE_INIT;
+static pthread_key_t xrp_heap_key;
+static __thread struct xrp_heap_cache *xrp_heap_thread_cache;
+
+static inline unsigned xrp_heap_class(size_t size)
+{
+	unsigned cls = 0;
+
+	while ((1ul << (cls + XRP_HEAP_MIN_SHIFT)) < size)
+		++cls;
+	return cls;
+}
+
+static void xrp_heap_put(struct xrp_heap *heap)
+{
+	if (--heap->ref == 0) {
+		pthread_mutex_destroy(&heap->mutex);
+		free(heap->arena);
+		free(heap);
+	}
+}
+
+/* Arena management, called with heap mutex held. */
+
+static void xrp_heap_release_arena(struct xrp_heap *heap,
+				   struct xrp_heap_arena *arena)
+{
+	struct xrp_ioctl_alloc ioctl_alloc = {
+		.addr = (uintptr_t)arena->ptr,
+	};
+	size_t i;
+
+	for (i = 0; i < heap->n_arenas; ++i) {
+		if (heap->arena[i] == arena) {
+			memmove(heap->arena + i, heap->arena + i + 1,
+				(heap->n_arenas - i - 1) * sizeof(*heap->arena));
+			--heap->n_arenas;
+			break;
+		}
+	}
+	ioctl(heap->fd, XRP_IOCTL_FREE, &ioctl_alloc);
+	free(arena);
+}
+
+static struct xrp_heap_arena *xrp_heap_new_arena(struct xrp_heap *heap)
+{
+	struct xrp_ioctl_alloc ioctl_alloc = {
+		.size = XRP_HEAP_ARENA_SIZE,
+	};
+	struct xrp_heap_arena *arena;
+	size_t i;
+
+	if (heap->empty_arena) {
+		arena = heap->empty_arena;
+		heap->empty_arena = arena->next;
+		heap->empty_size -= XRP_HEAP_ARENA_SIZE;
+		return arena;
+	}
+
+	if (heap->n_arenas == heap->capacity) {
+		size_t capacity = (heap->capacity + 2) * 2;
+		struct xrp_heap_arena **p = realloc(heap->arena,
+						    capacity * sizeof(*p));
+
+		if (!p)
+			return NULL;
+		heap->arena = p;
+		heap->capacity = capacity;
+	}
+
+	arena = malloc(sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	if (ioctl(heap->fd, XRP_IOCTL_ALLOC, &ioctl_alloc) < 0) {
+		free(arena);
+		return NULL;
+	}
+	arena->ptr = (char *)(uintptr_t)ioctl_alloc.addr;
+
+	for (i = heap->n_arenas; i > 0; --i) {
+		if (heap->arena[i - 1]->ptr < arena->ptr)
+			break;
+		heap->arena[i] = heap->arena[i - 1];
+	}
+	heap->arena[i] = arena;
+	++heap->n_arenas;
+	return arena;
+}
+
+static struct xrp_heap_arena *xrp_heap_find_arena(struct xrp_heap *heap,
+						  const char *p)
+{
+	size_t lo = 0, hi = heap->n_arenas;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		struct xrp_heap_arena *arena = heap->arena[mid];
+
+		if (p < arena->ptr)
+			hi = mid;
+		else if (p >= arena->ptr + XRP_HEAP_ARENA_SIZE)
+			lo = mid + 1;
+		else
+			return arena;
+	}
+	return NULL;
+}
+
+static size_t xrp_heap_get_objects(struct xrp_heap *heap, unsigned cls,
+				   void **ptr, size_t n)
+{
+	unsigned shift = cls + XRP_HEAP_MIN_SHIFT;
+	struct xrp_heap_arena *arena;
+	size_t i = 0;
+
+	pthread_mutex_lock(&heap->mutex);
+	for (arena = heap->class_arena[cls]; arena && i < n;
+	     arena = arena->next) {
+		for (; i < n && arena->n_free; ++i, ++arena->n_used)
+			ptr[i] = arena->ptr +
+				((size_t)arena->free_idx[--arena->n_free] << shift);
+		for (; i < n && arena->n_bump < arena->n_objects;
+		     ++i, ++arena->n_used)
+			ptr[i] = arena->ptr + (arena->n_bump++ << shift);
+	}
+	if (i == 0) {
+		arena = xrp_heap_new_arena(heap);
+		if (arena) {
+			arena->cls = cls;
+			arena->n_objects = XRP_HEAP_ARENA_SIZE >> shift;
+			arena->n_used = 0;
+			arena->n_bump = 0;
+			arena->n_free = 0;
+			arena->next = heap->class_arena[cls];
+			heap->class_arena[cls] = arena;
+
+			for (; i < n && arena->n_bump < arena->n_objects;
+			     ++i, ++arena->n_used)
+				ptr[i] = arena->ptr + (arena->n_bump++ << shift);
+		}
+	}
+	pthread_mutex_unlock(&heap->mutex);
+	return i;
+}
+
+static void _xrp_heap_put_objects(struct xrp_heap *heap, unsigned cls,
+				  void **ptr, size_t n)
+{
+	unsigned shift = cls + XRP_HEAP_MIN_SHIFT;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		struct xrp_heap_arena *arena = xrp_heap_find_arena(heap, ptr[i]);
+		struct xrp_heap_arena **pp;
+
+		if (!arena || arena->cls != cls)
+			continue;
+
+		arena->free_idx[arena->n_free++] =
+			((char *)ptr[i] - arena->ptr) >> shift;
+		if (--arena->n_used)
+			continue;
+
+		for (pp = heap->class_arena + cls; *pp != arena;
+		     pp = &(*pp)->next) {
+		}
+		*pp = arena->next;
+
+		if (heap->empty_size + XRP_HEAP_ARENA_SIZE > XRP_HEAP_HIGH_WATER) {
+			xrp_heap_release_arena(heap, arena);
+		} else {
+			arena->next = heap->empty_arena;
+			heap->empty_arena = arena;
+			heap->empty_size += XRP_HEAP_ARENA_SIZE;
+		}
+	}
+}
+
+static void xrp_heap_put_objects(struct xrp_heap *heap, unsigned cls,
+				 void **ptr, size_t n)
+{
+	pthread_mutex_lock(&heap->mutex);
+	if (!heap->dead)
+		_xrp_heap_put_objects(heap, cls, ptr, n);
+	pthread_mutex_unlock(&heap->mutex);
+}
+
+/* Thread caches. */
+
+static void xrp_heap_cache_destroy(struct xrp_heap_cache *cache)
+{
+	unsigned cls;
+
+	for (cls = 0; cls < XRP_HEAP_N_CLASSES; ++cls)
+		if (cache->n[cls])
+			xrp_heap_put_objects(cache->heap, cls,
+					     cache->ptr[cls], cache->n[cls]);
+	xrp_heap_put(cache->heap);
+	free(cache);
+}
+
+static void xrp_heap_thread_exit(void *p)
+{
+	struct xrp_heap_cache *cache = p;
+
+	while (cache) {
+		struct xrp_heap_cache *next = cache->next;
+
+		xrp_heap_cache_destroy(cache);
+		cache = next;
+	}
+	xrp_heap_thread_cache = NULL;
+}
+
+static void xrp_heap_init_key(void)
+{
+	pthread_key_create(&xrp_heap_key, xrp_heap_thread_exit);
+}
+
+static struct xrp_heap_cache *xrp_heap_get_cache(struct xrp_heap *heap)
+{
+	struct xrp_heap_cache *cache = xrp_heap_thread_cache;
+	struct xrp_heap_cache **pp;
+
+	if (cache && cache->heap == heap)
+		return cache;
+
+	/*
+	 * Look for this heap cache in the thread list dropping caches of
+	 * destroyed heaps on the way, move it to the list head.
+	 */
+	for (pp = &xrp_heap_thread_cache; *pp; ) {
+		cache = *pp;
+		if (cache->heap == heap) {
+			*pp = cache->next;
+			break;
+		}
+		if (cache->heap->dead) {
+			*pp = cache->next;
+			xrp_heap_cache_destroy(cache);
+		} else {
+			pp = &cache->next;
+		}
+		cache = NULL;
+	}
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return NULL;
+		pthread_once(&xrp_heap_once, xrp_heap_init_key);
+		(void)++heap->ref;
+		cache->heap = heap;
+	}
+	cache->next = xrp_heap_thread_cache;
+	xrp_heap_thread_cache = cache;
+	pthread_setspecific(xrp_heap_key, cache);
+	return cache;
+}
+
+/* Heap API. */
+
+struct xrp_heap *xrp_heap_create(int fd)
+{
+	struct xrp_heap *heap = calloc(1, sizeof(*heap));
+
+	if (heap) {
+		pthread_mutex_init(&heap->mutex, NULL);
+		heap->ref = 1;
+		heap->fd = fd;
+	}
+	return heap;
+}
+
+void xrp_heap_destroy(struct xrp_heap *heap)
+{
+	unsigned cls;
+
+	/*
+	 * Thread caches may still reference the heap, they will notice that
+	 * it's dead and drop the reference.
+	 */
+	pthread_mutex_lock(&heap->mutex);
+	heap->dead = 1;
+	while (heap->n_arenas)
+		xrp_heap_release_arena(heap, heap->arena[heap->n_arenas - 1]);
+	for (cls = 0; cls < XRP_HEAP_N_CLASSES; ++cls)
+		heap->class_arena[cls] = NULL;
+	heap->empty_arena = NULL;
+	heap->empty_size = 0;
+	pthread_mutex_unlock(&heap->mutex);
+	xrp_heap_put(heap);
+}
+
+void *xrp_heap_alloc(struct xrp_heap *heap, size_t size)
+{
+	struct xrp_heap_cache *cache;
+	unsigned cls;
+
+	if (!heap || size > (1ul << XRP_HEAP_MAX_SHIFT))
+		return NULL;
+
+	cls = xrp_heap_class(size);
+	cache = xrp_heap_get_cache(heap);
+	if (!cache)
+		return NULL;
+
+	if (!cache->n[cls])
+		cache->n[cls] = xrp_heap_get_objects(heap, cls, cache->ptr[cls],
+						     XRP_HEAP_CACHE_SIZE / 2);
+	if (!cache->n[cls])
+		return NULL;
+
+	return cache->ptr[cls][--cache->n[cls]];
+}
+
+void xrp_heap_free(struct xrp_heap *heap, void *p, size_t size)
+{
+	unsigned cls = xrp_heap_class(size);
+	struct xrp_heap_cache *cache = xrp_heap_get_cache(heap);
+
+	if (!cache) {
+		xrp_heap_put_objects(heap, cls, &p, 1);
+		return;
+	}
+
+	if (cache->n[cls] == XRP_HEAP_CACHE_SIZE) {
+		xrp_heap_put_objects(heap, cls,
+				     cache->ptr[cls] + XRP_HEAP_CACHE_SIZE / 2,
+				     XRP_HEAP_CACHE_SIZE / 2);
+		cache->n[cls] = XRP_HEAP_CACHE_SIZE / 2;
+	}
+	cache->ptr[cls][cache->n[cls]++] = p;
+}
+
+void xrp_heap_trim(struct xrp_heap *heap)
+{
+	if (!heap)
+		return;
+
+	pthread_mutex_lock(&heap->mutex);
+	while (heap->empty_arena) {
+		struct xrp_heap_arena *arena = heap->empty_arena;
+
+		heap->empty_arena = arena->next;
+		xrp_heap_release_arena(heap, arena);
+	}
+	heap->empty_size = 0;
+	pthread_mutex_unlock(&heap->mutex);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XRP_NATIVE_HEAP_H
+#define XRP_NATIVE_HEAP_H
+
+#include <stddef.h>
+
+struct xrp_heap;
+
+/*
+ * Create device memory heap on top of the XRP device file descriptor fd.
+ * The heap reserves arenas with XRP_IOCTL_ALLOC and serves small
+ * allocations from them without going to the kernel.
+ */
+struct xrp_heap *xrp_heap_create(int fd);
+
+/*
+ * Free all arenas of the heap. Must be called before fd is closed,
+ * when no allocations from the heap are in use.
+ */
+void xrp_heap_destroy(struct xrp_heap *heap);
+
+/*
+ * Allocate size bytes from the heap.
+ * Returns NULL if the size is not served by the heap or on failure,
+ * the caller should allocate directly from the device in that case.
+ */
+void *xrp_heap_alloc(struct xrp_heap *heap, size_t size);
+
+/*
+ * Return memory allocated by xrp_heap_alloc with the same size.
+ */
+void xrp_heap_free(struct xrp_heap *heap, void *p, size_t size);
+
+/*
+ * Give all unused arenas back to the device.
+ */
+void xrp_heap_trim(struct xrp_heap *heap);
+
+#endif
@@ -1 +0,0 @@
-../xrp-kernel/xrp_alloc.c
\ No newline at end of file
@@ -21,16 +21,21 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <libfdt.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_VALGRIND_MEMCHECK_H
@@ -43,6 +48,35 @@
 #define mb() barrier()
 #define schedule() barrier()
 
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() barrier()
+#endif
+
+/*
+ * linux/futex.h pulls in linux/types.h, whose __u64 clashes with ours.
+ */
+#ifndef FUTEX_WAIT
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#endif
+
+/*
+ * Spin budget for xrp_comm_wait32: it starts at the initial value, grows
+ * while the DSP keeps answering within the spin phase and shrinks when
+ * the waiter has to block.
+ */
+#define XRP_SPIN_MIN		64
+#define XRP_SPIN_INITIAL	4096
+#define XRP_SPIN_MAX		(1 << 20)
+
+/*
+ * Sleep bounds for the blocking phase of xrp_comm_wait32, in ns.
+ */
+#define XRP_BLOCK_MIN_NS	20000
+#define XRP_BLOCK_MAX_NS	2000000
+
 typedef uint8_t __u8;
 typedef uint32_t __u32;
 typedef uint64_t __u64;
@@ -50,7 +84,8 @@ typedef uint64_t __u64;
 #include "xrp_api.h"
 #include "../xrp-kernel/xrp_kernel_dsp_interface.h"
 #include "../xrp-kernel/xrp_hw_simple_dsp_interface.h"
-#include "xrp_private_alloc.h"
+#include "xrp_pool_cache.h"
+#include "xrp_shared_pool.h"
 
 #if defined(__STDC_NO_ATOMICS__)
 #warning The compiler does not support atomics, reference counting may not be thread safe
@@ -84,8 +119,22 @@ struct xrp_shmem {
 	void *ptr;
 };
 
+/*
+ * xrp_shmem is sorted by physical address, xrp_shmem_by_virt points to
+ * the same regions sorted by host virtual address. The last region found
+ * by each lookup is cached per thread.
+ */
 static struct xrp_shmem *xrp_shmem;
+static struct xrp_shmem **xrp_shmem_by_virt;
 static int xrp_shmem_count;
+static __thread struct xrp_shmem *xrp_shmem_last_phys;
+static __thread struct xrp_shmem *xrp_shmem_last_virt;
+
+struct xrp_host_allocation {
+	struct xrp_host_allocation *next;
+	struct xrp_allocation *allocation;
+	void *ptr;
+};
 
 struct xrp_device_description {
 	phys_addr_t io_base;
@@ -98,8 +147,10 @@ struct xrp_device_description {
 	uint32_t device_irq_mode;
 	uint32_t device_irq[3];
 	uint32_t device_irq_host_offset;
-	pthread_mutex_t hw_mutex;
+	pthread_mutex_t *hw_mutex;
 	struct xrp_allocation_pool *shared_pool;
+	struct xrp_host_allocation *host_allocation;
+	unsigned spin_limit;
 };
 
 static struct xrp_device_description xrp_device_description[4];
@@ -120,7 +171,10 @@ struct xrp_request {
 	void *out_data_ptr;
 	size_t out_data_size;
 	struct xrp_buffer_group *buffer_group;
+	struct xrp_command_list *command_list;
 	struct xrp_event *event;
+	size_t n_wait_events;
+	struct xrp_event **wait_event;
 
 	struct xrp_allocation *in_data_allocation;
 	struct xrp_allocation *out_data_allocation;
@@ -132,16 +186,6 @@ struct xrp_request {
 struct xrp_device {
 	struct xrp_refcounted ref;
 	struct xrp_device_description *description;
-
-	pthread_t thread;
-	pthread_mutex_t request_queue_mutex;
-	pthread_cond_t request_queue_cond;
-	struct {
-		struct xrp_request *head;
-		struct xrp_request *tail;
-	} request_queue;
-	int exit;
-	int *sync_exit;
 };
 
 struct xrp_buffer {
@@ -151,7 +195,10 @@ struct xrp_buffer {
 		XRP_BUFFER_TYPE_HOST,
 		XRP_BUFFER_TYPE_DEVICE,
 	} type;
+	struct xrp_buffer *parent;
 	struct xrp_allocation *xrp_allocation;
+	int user_ptr;
+	phys_addr_t addr;
 	void *ptr;
 	size_t size;
 	_Atomic unsigned long map_count;
@@ -169,6 +216,8 @@ struct xrp_buffer_group {
 	size_t n_buffers;
 	size_t capacity;
 	struct xrp_buffer_group_record *buffer;
+	_Atomic int sealed;
+	struct xrp_dsp_buffer *dsp_buffer;
 };
 
 struct xrp_queue {
@@ -176,6 +225,16 @@ struct xrp_queue {
 	struct xrp_device *device;
 	int use_nsid;
 	char nsid[XRP_NAMESPACE_ID_SIZE];
+
+	pthread_t thread;
+	pthread_mutex_t request_queue_mutex;
+	pthread_cond_t request_queue_cond;
+	struct {
+		struct xrp_request *head;
+		struct xrp_request *tail;
+	} request_queue;
+	int exit;
+	int *sync_exit;
 };
 
 struct xrp_event {
@@ -186,6 +245,32 @@ struct xrp_event {
 	_Atomic enum xrp_status status;
 };
 
+struct xrp_command_list_buffer {
+	struct xrp_buffer *buffer;
+	enum xrp_access_flags access_flags;
+	struct xrp_allocation *allocation;
+};
+
+struct xrp_command_list_record {
+	struct xrp_dsp_cmd dsp_cmd;
+	void *out_data;
+	struct xrp_allocation *in_data_allocation;
+	struct xrp_allocation *out_data_allocation;
+	struct xrp_allocation *buffer_allocation;
+	size_t n_buffers;
+	struct xrp_command_list_buffer *buffer;
+};
+
+struct xrp_command_list {
+	struct xrp_refcounted ref;
+	struct xrp_queue *queue;
+	pthread_mutex_t mutex;
+	size_t n_commands;
+	size_t capacity;
+	struct xrp_command_list_record **command;
+	_Atomic int queued;
+};
+
 /* Helpers */
 
 static inline void set_status(enum xrp_status *status, enum xrp_status v)
@@ -243,32 +328,101 @@ static uint32_t getprop_u32(const void *value, int offset)
 	return fdt32_to_cpu(v);
 }
 
+static inline int shmem_has_phys(const struct xrp_shmem *shmem,
+				 phys_addr_t addr)
+{
+	return addr >= shmem->start && addr - shmem->start < shmem->size;
+}
+
+static inline int shmem_has_virt(const struct xrp_shmem *shmem,
+				 const void *p)
+{
+	return (const char *)p >= (const char *)shmem->ptr &&
+		(size_t)((const char *)p - (const char *)shmem->ptr) <
+		shmem->size;
+}
+
 static struct xrp_shmem *find_shmem_by_phys(phys_addr_t addr)
 {
-	int i;
+	struct xrp_shmem *shmem = xrp_shmem_last_phys;
+	int lo = 0, hi = xrp_shmem_count;
 
-	for (i = 0; i < xrp_shmem_count; ++i) {
-		if (addr >= xrp_shmem[i].start &&
-		    addr - xrp_shmem[i].start < xrp_shmem[i].size)
-			return xrp_shmem + i;
+	if (shmem && shmem_has_phys(shmem, addr))
+		return shmem;
+
+	while (lo < hi) {
+		int i = (lo + hi) / 2;
+
+		shmem = xrp_shmem + i;
+		if (addr < shmem->start) {
+			hi = i;
+		} else if (addr - shmem->start >= shmem->size) {
+			lo = i + 1;
+		} else {
+			xrp_shmem_last_phys = shmem;
+			return shmem;
+		}
 	}
 	return NULL;
 }
 
 static struct xrp_shmem *find_shmem_by_virt(const void *p)
 {
-	int i;
+	struct xrp_shmem *shmem = xrp_shmem_last_virt;
+	int lo = 0, hi = xrp_shmem_count;
 
-	for (i = 0; i < xrp_shmem_count; ++i) {
-		size_t d = (const char *)p - (const char *)xrp_shmem[i].ptr;
+	if (shmem && shmem_has_virt(shmem, p))
+		return shmem;
+
+	while (lo < hi) {
+		int i = (lo + hi) / 2;
 
-		if (p >= xrp_shmem[i].ptr &&
-		    d < xrp_shmem[i].size)
-			return xrp_shmem + i;
+		shmem = xrp_shmem_by_virt[i];
+		if ((const char *)p < (const char *)shmem->ptr) {
+			hi = i;
+		} else if (!shmem_has_virt(shmem, p)) {
+			lo = i + 1;
+		} else {
+			xrp_shmem_last_virt = shmem;
+			return shmem;
+		}
 	}
 	return NULL;
 }
 
+static int compare_shmem_phys(const void *a, const void *b)
+{
+	const struct xrp_shmem *pa = a;
+	const struct xrp_shmem *pb = b;
+
+	return (pa->start > pb->start) - (pa->start < pb->start);
+}
+
+static int compare_shmem_virt(const void *a, const void *b)
+{
+	const char *pa = (*(struct xrp_shmem * const *)a)->ptr;
+	const char *pb = (*(struct xrp_shmem * const *)b)->ptr;
+
+	return (pa > pb) - (pa < pb);
+}
+
+/*
+ * Only regions that were successfully mapped take part in the lookups.
+ */
+static void sort_shmem(int count)
+{
+	int i;
+
+	xrp_shmem_count = count;
+	qsort(xrp_shmem, count, sizeof(*xrp_shmem), compare_shmem_phys);
+
+	xrp_shmem_by_virt = malloc(count * sizeof(*xrp_shmem_by_virt));
+	for (i = 0; i < count; ++i)
+		xrp_shmem_by_virt[i] = xrp_shmem + i;
+	qsort(xrp_shmem_by_virt, count, sizeof(*xrp_shmem_by_virt),
+	      compare_shmem_virt);
+}
+
 static void *p2v(phys_addr_t addr)
 {
 	struct xrp_shmem *shmem = find_shmem_by_phys(addr);
@@ -303,6 +457,50 @@ static inline __u32 xrp_comm_read32(const volatile void *addr)
 	return *(volatile __u32 *)addr;
 }
 
+/*
+ * Wait until (*addr & mask) == value.
+ *
+ * The comm area is the only channel from the simulated DSP to the host,
+ * so the host emulates the host IRQ with a futex on the polled word.
+ * Spin for up to *spin_limit iterations first, then block on the futex
+ * with a timeout that doubles up to XRP_BLOCK_MAX_NS. A DSP that can
+ * issue FUTEX_WAKE on the word ends the wait immediately, one that
+ * can't (e.g. the ISS) is noticed after at most one timeout.
+ * *spin_limit is adjusted to the observed latency.
+ */
+static void xrp_comm_wait32(volatile void *addr, __u32 mask, __u32 value,
+			    unsigned *spin_limit)
+{
+	struct timespec timeout = {
+		.tv_nsec = XRP_BLOCK_MIN_NS,
+	};
+	unsigned limit = *spin_limit;
+	unsigned i;
+	__u32 v;
+
+	for (i = 0; i < limit; ++i) {
+		if ((xrp_comm_read32(addr) & mask) == value) {
+			if (i > limit / 2 && limit < XRP_SPIN_MAX)
+				*spin_limit = limit * 2;
+			return;
+		}
+		cpu_relax();
+	}
+
+	if (limit > XRP_SPIN_MIN)
+		*spin_limit = limit / 2;
+
+	for (;;) {
+		v = xrp_comm_read32(addr);
+		if ((v & mask) == value)
+			break;
+		syscall(SYS_futex, addr, FUTEX_WAIT, v, &timeout, NULL, 0);
+		if (timeout.tv_nsec < XRP_BLOCK_MAX_NS / 2)
+			timeout.tv_nsec *= 2;
+	}
+	barrier();
+}
+
 static void initialize_shmem(void)
 {
 	void *fdt = &dt_blob_start;
@@ -374,6 +572,8 @@ static void initialize_shmem(void)
 			break;
 		}
 	}
+	sort_shmem(i);
+
 	reg = fdt_getprop(fdt, offset, "exit-loc", &reg_len);
 	if (!reg) {
 		printf("%s: fdt_getprop \"exit-loc\": %s\n",
@@ -394,8 +594,18 @@ static inline void xrp_send_device_irq(struct xrp_device_description *desc)
 	case XRP_IRQ_LEVEL:
 		mb();
 		xrp_comm_write32(device_irq, 1 << desc->device_irq[1]);
+		/*
+		 * Wake up the DSP running as a host process, see
+		 * xrp-dsp/xrp_dsp_hw_host.c. No-op for the ISS.
+		 */
+		syscall(SYS_futex, device_irq, FUTEX_WAKE, 1, NULL, NULL, 0);
 		break;
 	default:
+		/*
+		 * Without device IRQ the DSP host process waits for changes
+		 * of the comm area.
+		 */
+		syscall(SYS_futex, desc->comm_ptr, FUTEX_WAKE, 1, NULL, NULL, 0);
 		break;
 	}
 }
@@ -416,12 +626,8 @@ static void synchronize(struct xrp_device_description *desc)
 	xrp_comm_write32(&shared_sync->sync, XRP_DSP_SYNC_START);
 	mb();
 	xrp_send_device_irq(desc);
-	do {
-		__u32 v = xrp_comm_read32(&shared_sync->sync);
-		if (v == XRP_DSP_SYNC_DSP_READY)
-			break;
-		schedule();
-	} while (1);
+	xrp_comm_wait32(&shared_sync->sync, 0xffffffff,
+			XRP_DSP_SYNC_DSP_READY, &desc->spin_limit);
 
 	xrp_comm_write32(&hw_sync->device_mmio_base,
 			 desc->io_base);
@@ -443,12 +649,8 @@ static void synchronize(struct xrp_device_description *desc)
 	xrp_comm_write32(&shared_sync->sync, XRP_DSP_SYNC_HOST_TO_DSP);
 	mb();
 
-	do {
-		__u32 v = xrp_comm_read32(&shared_sync->sync);
-		if (v == XRP_DSP_SYNC_DSP_TO_HOST)
-			break;
-		schedule();
-	} while (1);
+	xrp_comm_wait32(&shared_sync->sync, 0xffffffff,
+			XRP_DSP_SYNC_DSP_TO_HOST, &desc->spin_limit);
 
 	xrp_send_device_irq(desc);
 
@@ -467,6 +669,171 @@ static void synchronize(struct xrp_device_description *desc)
 
 }
 
+/*
+ * Host side state of a simulated device shared by all processes that use
+ * it: locks, attached processes and the shared pool allocation state.
+ * It occupies the first pages of the device shared area, the DSP only
+ * accesses that area at addresses passed to it in commands.
+ */
+#define XRP_SHARED_STATE_INIT	0x58525069
+#define XRP_SHARED_STATE_READY	0x58525072
+#define XRP_SHARED_MAX_PROCESSES	32
+
+struct xrp_shared_state {
+	uint32_t magic;
+	/* guards the process table */
+	pthread_mutex_t mutex;
+	/* serializes access to the comm area */
+	pthread_mutex_t hw_mutex;
+	pid_t process[XRP_SHARED_MAX_PROCESSES];
+	char pool_state[] __attribute__((aligned(8)));
+};
+
+static void xrp_init_shared_mutex(pthread_mutex_t *mutex)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void xrp_shared_lock(pthread_mutex_t *mutex)
+{
+	if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+		pthread_mutex_consistent(mutex);
+}
+
+/*
+ * If the process that owned the comm area died, its command may still be
+ * running on the DSP, let it complete before the comm area is reused.
+ */
+static void xrp_hw_lock(struct xrp_device_description *desc)
+{
+	if (pthread_mutex_lock(desc->hw_mutex) == EOWNERDEAD) {
+		struct xrp_dsp_cmd *dsp_cmd = desc->comm_ptr;
+
+		if (xrp_comm_read32(&dsp_cmd->flags) &
+		    XRP_DSP_CMD_FLAG_REQUEST_VALID)
+			xrp_comm_wait32(&dsp_cmd->flags,
+					XRP_DSP_CMD_FLAG_RESPONSE_VALID,
+					XRP_DSP_CMD_FLAG_RESPONSE_VALID,
+					&desc->spin_limit);
+		pthread_mutex_consistent(desc->hw_mutex);
+	}
+}
+
+static int xrp_process_alive(pid_t pid)
+{
+	return pid && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/*
+ * Register this process as a user of the device. The first process
+ * initializes the shared pool and synchronizes with the DSP, the others
+ * find it ready. A device whose processes all died is treated as new.
+ */
+static int xrp_attach_device(struct xrp_device_description *desc)
+{
+	struct xrp_shared_state *state = desc->shared_ptr;
+	uint32_t magic = __atomic_load_n(&state->magic, __ATOMIC_ACQUIRE);
+	size_t state_size = (sizeof(*state) +
+			     xrp_shared_pool_state_size(desc->shared_size) +
+			     4095) & ~(size_t)4095;
+	pid_t pid = getpid();
+	int n_alive = 0;
+	int slot = -1;
+	int i;
+
+	if (state_size >= desc->shared_size) {
+		printf("%s: shared area @0x%08x is too small\n",
+		       __func__, desc->shared_base);
+		return 0;
+	}
+
+	while (magic != XRP_SHARED_STATE_READY) {
+		if (magic != XRP_SHARED_STATE_INIT &&
+		    __atomic_compare_exchange_n(&state->magic, &magic,
+						XRP_SHARED_STATE_INIT, 0,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_ACQUIRE)) {
+			xrp_init_shared_mutex(&state->mutex);
+			xrp_init_shared_mutex(&state->hw_mutex);
+			memset(state->process, 0, sizeof(state->process));
+			__atomic_store_n(&state->magic, XRP_SHARED_STATE_READY,
+					 __ATOMIC_RELEASE);
+			break;
+		}
+		sched_yield();
+		magic = __atomic_load_n(&state->magic, __ATOMIC_ACQUIRE);
+	}
+	desc->hw_mutex = &state->hw_mutex;
+
+	xrp_shared_lock(&state->mutex);
+	for (i = 0; i < XRP_SHARED_MAX_PROCESSES; ++i) {
+		if (xrp_process_alive(state->process[i]) &&
+		    state->process[i] != pid) {
+			++n_alive;
+		} else {
+			state->process[i] = 0;
+			if (slot < 0)
+				slot = i;
+		}
+	}
+	if (slot < 0) {
+		pthread_mutex_unlock(&state->mutex);
+		printf("%s: too many processes use the device\n", __func__);
+		return 0;
+	}
+	state->process[slot] = pid;
+
+	/*
+	 * Other processes wait for the synchronization on the hw_mutex.
+	 * Nothing that was left in the comm area by dead processes is
+	 * waited for when the DSP is synchronized anew.
+	 */
+	if (n_alive) {
+		xrp_hw_lock(desc);
+	} else {
+		xrp_shared_lock(desc->hw_mutex);
+		xrp_shared_pool_init_state(state->pool_state,
+					   desc->shared_size - state_size);
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	xrp_init_shared_pool(&desc->shared_pool, state->pool_state,
+			     desc->shared_base + state_size,
+			     desc->shared_size - state_size);
+	if (!n_alive)
+		synchronize(desc);
+	pthread_mutex_unlock(desc->hw_mutex);
+	return 1;
+}
+
+/*
+ * Unregister this process, return the number of other processes that
+ * still use the device.
+ */
+static int xrp_detach_device(struct xrp_device_description *desc)
+{
+	struct xrp_shared_state *state = desc->shared_ptr;
+	pid_t pid = getpid();
+	int n_alive = 0;
+	int i;
+
+	xrp_shared_lock(&state->mutex);
+	for (i = 0; i < XRP_SHARED_MAX_PROCESSES; ++i) {
+		if (state->process[i] == pid)
+			state->process[i] = 0;
+		else if (xrp_process_alive(state->process[i]))
+			++n_alive;
+	}
+	pthread_mutex_unlock(&state->mutex);
+	return n_alive;
+}
+
 struct of_node_match {
 	const char *compatible;
 	int (*init)(void *fdt, int offset,
@@ -488,9 +855,7 @@ static int init_cdns_xrp_common(struct xrp_device_description *description)
 		       __func__, description->shared_base);
 		return 0;
 	}
-	xrp_init_private_pool(&description->shared_pool,
-			      description->shared_base,
-			      description->shared_size);
+	description->spin_limit = XRP_SPIN_INITIAL;
 	return 1;
 }
 
@@ -516,7 +881,6 @@ static int init_cdns_xrp(void *fdt, int offset,
 		.comm_base = getprop_u32(reg, 8),
 		.shared_base = getprop_u32(reg, 16),
 		.shared_size = getprop_u32(reg, 20),
-		.hw_mutex = PTHREAD_MUTEX_INITIALIZER,
 	};
 	return init_cdns_xrp_common(description);
 }
@@ -543,7 +907,6 @@ static int init_cdns_xrp_v1(void *fdt, int offset,
 		.shared_base = getprop_u32(reg, 0) + 4096,
 		.shared_size = getprop_u32(reg, 4) - 4096,
 		.io_base = getprop_u32(reg, 8),
-		.hw_mutex = PTHREAD_MUTEX_INITIALIZER,
 	};
 	return init_cdns_xrp_common(description);
 }
@@ -652,7 +1015,9 @@ static void initialize(void)
 		if (ret == 0)
 			continue;
 
-		synchronize(xrp_device_description + xrp_device_count);
+		if (!xrp_attach_device(xrp_device_description +
+				       xrp_device_count))
+			continue;
 		++xrp_device_count;
 	}
 
@@ -660,18 +1025,6 @@ static void initialize(void)
 
 /* Device API. */
 
-static int xrp_queue_process(struct xrp_device *device);
-
-static void *xrp_device_thread(void *p)
-{
-	struct xrp_device *device = p;
-
-	while (xrp_queue_process(device)) {
-	}
-
-	return NULL;
-}
-
 struct xrp_device *xrp_open_device(int idx, enum xrp_status *status)
 {
 	struct xrp_device *device;
@@ -691,10 +1044,6 @@ struct xrp_device *xrp_open_device(int idx, enum xrp_status *status)
 		return NULL;
 	}
 	device->description = xrp_device_description + idx;
-
-	pthread_mutex_init(&device->request_queue_mutex, NULL);
-	pthread_cond_init(&device->request_queue_cond, NULL);
-	pthread_create(&device->thread, NULL, xrp_device_thread, device);
 	set_status(status, XRP_STATUS_SUCCESS);
 	return device;
 }
@@ -706,24 +1055,78 @@ void xrp_retain_device(struct xrp_device *device, enum xrp_status *status)
 
 void xrp_release_device(struct xrp_device *device, enum xrp_status *status)
 {
-	if (last_refcount(device)) {
-		pthread_mutex_lock(&device->request_queue_mutex);
-		device->exit = 1;
-		pthread_cond_broadcast(&device->request_queue_cond);
-		pthread_mutex_unlock(&device->request_queue_mutex);
-		if (pthread_join(device->thread, NULL) != 0) {
-			*device->sync_exit = 1;
-			pthread_detach(device->thread);
+	set_status(status, release_refcounted(device));
+}
+
+
+/* Host memory API. */
+
+static pthread_mutex_t xrp_host_allocation_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int xrp_is_shared(const struct xrp_device_description *description,
+			 const void *p, size_t size)
+{
+	const char *start = description->shared_ptr;
+
+	return (const char *)p >= start &&
+		(size_t)((const char *)p - start) <= description->shared_size &&
+		size <= description->shared_size -
+		(size_t)((const char *)p - start);
+}
+
+void *xrp_host_alloc(struct xrp_device *device, size_t size,
+		     enum xrp_status *status)
+{
+	struct xrp_device_description *description = device->description;
+	struct xrp_host_allocation *host_allocation;
+	long rc;
+
+	host_allocation = malloc(sizeof(*host_allocation));
+	if (!host_allocation) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+	rc = xrp_pool_allocate(description->shared_pool, size, 0x40,
+			       &host_allocation->allocation);
+	if (rc < 0) {
+		free(host_allocation);
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+	host_allocation->ptr = p2v(host_allocation->allocation->start);
+
+	pthread_mutex_lock(&xrp_host_allocation_mutex);
+	host_allocation->next = description->host_allocation;
+	description->host_allocation = host_allocation;
+	pthread_mutex_unlock(&xrp_host_allocation_mutex);
+
+	set_status(status, XRP_STATUS_SUCCESS);
+	return host_allocation->ptr;
+}
+
+void xrp_host_free(struct xrp_device *device, void *p,
+		   enum xrp_status *status)
+{
+	struct xrp_device_description *description = device->description;
+	struct xrp_host_allocation **pcur;
+	struct xrp_host_allocation *cur = NULL;
+
+	pthread_mutex_lock(&xrp_host_allocation_mutex);
+	for (pcur = &description->host_allocation; *pcur;
+	     pcur = &(*pcur)->next) {
+		if ((*pcur)->ptr == p) {
+			cur = *pcur;
+			*pcur = cur->next;
+			break;
 		}
-		pthread_mutex_lock(&device->request_queue_mutex);
-		if (device->request_queue.head != NULL)
-			printf("%s: releasing a device with non-empty queue\n",
-			       __func__);
-		pthread_mutex_unlock(&device->request_queue_mutex);
-		pthread_mutex_destroy(&device->request_queue_mutex);
-		pthread_cond_destroy(&device->request_queue_cond);
 	}
-	set_status(status, release_refcounted(device));
+	pthread_mutex_unlock(&xrp_host_allocation_mutex);
+
+	if (cur) {
+		xrp_pool_free(cur->allocation);
+		free(cur);
+	}
+	set_status(status, cur ? XRP_STATUS_SUCCESS : XRP_STATUS_FAILURE);
 }
 
 
@@ -748,7 +1151,7 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 	}
 
 	if (!host_ptr) {
-		long rc = xrp_allocate(device->description->shared_pool, size,
+		long rc = xrp_pool_allocate(device->description->shared_pool, size,
 				       0x10, &buf->xrp_allocation);
 		if (rc < 0) {
 			release_refcounted(buf);
@@ -756,7 +1159,18 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 			return NULL;
 		}
 		buf->type = XRP_BUFFER_TYPE_DEVICE;
-		buf->ptr = p2v(buf->xrp_allocation->start);
+		buf->addr = buf->xrp_allocation->start;
+		buf->ptr = p2v(buf->addr);
+		buf->size = size;
+	} else if (device && xrp_is_shared(device->description,
+					   host_ptr, size)) {
+		/*
+		 * Host memory in the shared pool is used by the DSP in place.
+		 */
+		buf->type = XRP_BUFFER_TYPE_DEVICE;
+		buf->user_ptr = 1;
+		buf->addr = v2p(host_ptr);
+		buf->ptr = host_ptr;
 		buf->size = size;
 	} else {
 		buf->type = XRP_BUFFER_TYPE_HOST;
@@ -767,6 +1181,36 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 	return buf;
 }
 
+struct xrp_buffer *xrp_create_sub_buffer(struct xrp_buffer *parent,
+					 size_t offset, size_t size,
+					 enum xrp_status *status)
+{
+	struct xrp_buffer *buf;
+
+	if (offset > parent->size || size > parent->size - offset) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	buf = alloc_refcounted(sizeof(*buf));
+
+	if (!buf) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	xrp_retain_buffer(parent, NULL);
+	buf->parent = parent;
+	buf->device = parent->device;
+	buf->type = parent->type;
+	buf->user_ptr = parent->user_ptr;
+	buf->addr = parent->addr + offset;
+	buf->ptr = parent->ptr + offset;
+	buf->size = size;
+	set_status(status, XRP_STATUS_SUCCESS);
+	return buf;
+}
+
 void xrp_retain_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 {
 	set_status(status, retain_refcounted(buffer));
@@ -775,8 +1219,10 @@ void xrp_retain_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 void xrp_release_buffer(struct xrp_buffer *buffer, enum xrp_status *status)
 {
 	if (last_refcount(buffer)) {
-		if (buffer->type == XRP_BUFFER_TYPE_DEVICE) {
-			xrp_free(buffer->xrp_allocation);
+		if (buffer->parent) {
+			xrp_release_buffer(buffer->parent, NULL);
+		} else if (buffer->xrp_allocation) {
+			xrp_pool_free(buffer->xrp_allocation);
 		}
 	}
 	set_status(status, release_refcounted(buffer));
@@ -822,7 +1268,8 @@ void xrp_buffer_get_info(struct xrp_buffer *buffer, enum xrp_buffer_info info,
 		break;
 
 	case XRP_BUFFER_HOST_POINTER_PTR:
-		if (buffer->type != XRP_BUFFER_TYPE_HOST) {
+		if (buffer->type != XRP_BUFFER_TYPE_HOST &&
+		    !buffer->user_ptr) {
 			static void *p = NULL;
 			ptr = &p;
 		} else {
@@ -878,6 +1325,7 @@ void xrp_release_buffer_group(struct xrp_buffer_group *group,
 		pthread_mutex_unlock(&group->mutex);
 		pthread_mutex_destroy(&group->mutex);
 		free(group->buffer);
+		free(group->dsp_buffer);
 	}
 	set_status(status, release_refcounted(group));
 }
@@ -891,6 +1339,11 @@ size_t xrp_add_buffer_to_group(struct xrp_buffer_group *group,
 	size_t n_buffers;
 
 	pthread_mutex_lock(&group->mutex);
+	if (group->sealed) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
 	if (group->n_buffers == group->capacity) {
 		struct xrp_buffer_group_record *r =
 			realloc(group->buffer,
@@ -934,7 +1387,7 @@ void xrp_set_buffer_in_group(struct xrp_buffer_group *group,
 		struct xrp_buffer *old_buffer;
 
 		pthread_mutex_lock(&group->mutex);
-		if (index < group->n_buffers) {
+		if (index < group->n_buffers && !group->sealed) {
 			old_buffer = group->buffer[index].buffer;
 			group->buffer[index].buffer = buffer;
 			group->buffer[index].access_flags = access_flags;
@@ -1002,9 +1455,59 @@ out:
 	set_status(status, s);
 }
 
+void xrp_seal_buffer_group(struct xrp_buffer_group *group,
+			   enum xrp_status *status)
+{
+	struct xrp_dsp_buffer *dsp_buffer;
+	size_t i;
+
+	pthread_mutex_lock(&group->mutex);
+	if (group->sealed) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_SUCCESS);
+		return;
+	}
+	dsp_buffer = malloc(group->n_buffers * sizeof(*dsp_buffer));
+	if (group->n_buffers && !dsp_buffer) {
+		pthread_mutex_unlock(&group->mutex);
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	for (i = 0; i < group->n_buffers; ++i) {
+		struct xrp_buffer *buffer = group->buffer[i].buffer;
+
+		/*
+		 * Device buffers have fixed physical address, host buffers
+		 * get their address when they're staged for the command.
+		 */
+		dsp_buffer[i] = (struct xrp_dsp_buffer){
+			.flags = group->buffer[i].access_flags,
+			.size = buffer->size,
+			.addr = buffer->type == XRP_BUFFER_TYPE_DEVICE ?
+				buffer->addr : 0,
+		};
+	}
+	group->dsp_buffer = dsp_buffer;
+	group->sealed = 1;
+	pthread_mutex_unlock(&group->mutex);
+	set_status(status, XRP_STATUS_SUCCESS);
+}
+
 
 /* Queue API. */
 
+static int xrp_queue_process(struct xrp_queue *queue);
+
+static void *xrp_queue_thread(void *p)
+{
+	struct xrp_queue *queue = p;
+
+	while (xrp_queue_process(queue)) {
+	}
+
+	return NULL;
+}
+
 struct xrp_queue *xrp_create_queue(struct xrp_device *device,
 				   enum xrp_status *status)
 {
@@ -1041,6 +1544,10 @@ struct xrp_queue *xrp_create_ns_queue(struct xrp_device *device,
 		queue->use_nsid = 1;
 		memcpy(queue->nsid, nsid, XRP_NAMESPACE_ID_SIZE);
 	}
+
+	pthread_mutex_init(&queue->request_queue_mutex, NULL);
+	pthread_cond_init(&queue->request_queue_cond, NULL);
+	pthread_create(&queue->thread, NULL, xrp_queue_thread, queue);
 	set_status(status, XRP_STATUS_SUCCESS);
 
 	return queue;
@@ -1056,7 +1563,23 @@ void xrp_release_queue(struct xrp_queue *queue, enum xrp_status *status)
 	if (last_refcount(queue)) {
 		enum xrp_status s;
 
-		xrp_release_device(queue->device, &s);
+		pthread_mutex_lock(&queue->request_queue_mutex);
+		queue->exit = 1;
+		pthread_cond_broadcast(&queue->request_queue_cond);
+		pthread_mutex_unlock(&queue->request_queue_mutex);
+		if (pthread_join(queue->thread, NULL) != 0) {
+			*queue->sync_exit = 1;
+			pthread_detach(queue->thread);
+		}
+		pthread_mutex_lock(&queue->request_queue_mutex);
+		if (queue->request_queue.head != NULL)
+			printf("%s: releasing a queue with pending requests\n",
+			       __func__);
+		pthread_mutex_unlock(&queue->request_queue_mutex);
+		pthread_mutex_destroy(&queue->request_queue_mutex);
+		pthread_cond_destroy(&queue->request_queue_cond);
+
+		xrp_release_device(queue->device, &s);
 		if (s != XRP_STATUS_SUCCESS) {
 			set_status(status, s);
 			return;
@@ -1094,6 +1617,31 @@ void xrp_event_status(struct xrp_event *event, enum xrp_status *status)
 	set_status(status, event->status);
 }
 
+static struct xrp_event *xrp_create_event(struct xrp_device *device,
+					  enum xrp_status *status)
+{
+	struct xrp_event *event;
+	enum xrp_status s;
+
+	event = alloc_refcounted(sizeof(*event));
+	if (!event) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+	xrp_retain_device(device, &s);
+	if (s != XRP_STATUS_SUCCESS) {
+		set_status(status, s);
+		release_refcounted(event);
+		return NULL;
+	}
+	event->device = device;
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->status = XRP_STATUS_PENDING;
+	set_status(status, XRP_STATUS_SUCCESS);
+	return event;
+}
+
 /* Communication API */
 
 void xrp_run_command_sync(struct xrp_queue *queue,
@@ -1117,90 +1665,220 @@ void xrp_run_command_sync(struct xrp_queue *queue,
 	xrp_release_event(evt, NULL);
 }
 
-static void xrp_enqueue_request(struct xrp_device *device,
+static void xrp_enqueue_request(struct xrp_queue *queue,
 				struct xrp_request *rq)
 {
-	pthread_mutex_lock(&device->request_queue_mutex);
+	pthread_mutex_lock(&queue->request_queue_mutex);
 	rq->next = NULL;
-	if (device->request_queue.tail) {
-		device->request_queue.tail->next = rq;
+	if (queue->request_queue.tail) {
+		queue->request_queue.tail->next = rq;
 	} else {
-		device->request_queue.head = rq;
-		pthread_cond_broadcast(&device->request_queue_cond);
+		queue->request_queue.head = rq;
+		pthread_cond_broadcast(&queue->request_queue_cond);
 	}
-	device->request_queue.tail = rq;
-	pthread_mutex_unlock(&device->request_queue_mutex);
+	queue->request_queue.tail = rq;
+	pthread_mutex_unlock(&queue->request_queue_mutex);
 }
 
-static struct xrp_request *_xrp_dequeue_request(struct xrp_device *device)
+static struct xrp_request *_xrp_dequeue_request(struct xrp_queue *queue)
 {
-	struct xrp_request *rq = device->request_queue.head;
+	struct xrp_request *rq = queue->request_queue.head;
 
 	if (!rq)
 		return NULL;
 
-	if (rq == device->request_queue.tail)
-		device->request_queue.tail = NULL;
-	device->request_queue.head = rq->next;
+	if (rq == queue->request_queue.tail)
+		queue->request_queue.tail = NULL;
+	queue->request_queue.head = rq->next;
 	return rq;
 }
 
-static int xrp_queue_process(struct xrp_device *device)
+static void xrp_run_hw_command(struct xrp_device *device,
+			       struct xrp_dsp_cmd *cmd)
 {
 	struct xrp_dsp_cmd *dsp_cmd = device->description->comm_ptr;
+
+	memcpy(dsp_cmd, cmd, sizeof(*cmd));
+	barrier();
+	xrp_comm_write32(&dsp_cmd->flags,
+			 cmd->flags | XRP_DSP_CMD_FLAG_REQUEST_VALID);
+	barrier();
+	xrp_send_device_irq(device->description);
+	xrp_comm_wait32(&dsp_cmd->flags,
+			XRP_DSP_CMD_FLAG_REQUEST_VALID |
+			XRP_DSP_CMD_FLAG_RESPONSE_VALID,
+			XRP_DSP_CMD_FLAG_REQUEST_VALID |
+			XRP_DSP_CMD_FLAG_RESPONSE_VALID,
+			&device->description->spin_limit);
+
+	memcpy(cmd, dsp_cmd, sizeof(*cmd));
+}
+
+static void xrp_complete_event(struct xrp_event *event,
+			       enum xrp_status status)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->status = status;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->mutex);
+	xrp_release_event(event, NULL);
+}
+
+static enum xrp_status xrp_run_command_list(struct xrp_device *device,
+					    struct xrp_command_list *list)
+{
+	enum xrp_status s = XRP_STATUS_SUCCESS;
+	size_t i, j;
+
+	xrp_hw_lock(device->description);
+	for (i = 0; i < list->n_commands; ++i) {
+		struct xrp_command_list_record *command = list->command[i];
+		struct xrp_dsp_cmd dsp_cmd = command->dsp_cmd;
+		size_t out_data_size = dsp_cmd.out_data_size;
+		void *out_data_ptr;
+
+		xrp_run_hw_command(device, &dsp_cmd);
+
+		if (out_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE)
+			out_data_ptr = p2v(command->out_data_allocation->start);
+		else
+			out_data_ptr = &dsp_cmd.out_data;
+		VALGRIND_MAKE_MEM_DEFINED(out_data_ptr, out_data_size);
+		memcpy(command->out_data, out_data_ptr, out_data_size);
+
+		for (j = 0; j < command->n_buffers; ++j) {
+			struct xrp_command_list_buffer *buffer =
+				command->buffer + j;
+
+			if (buffer->allocation &&
+			    (buffer->access_flags & XRP_WRITE))
+				memcpy(buffer->buffer->ptr,
+				       p2v(buffer->allocation->start),
+				       buffer->buffer->size);
+		}
+		if (dsp_cmd.flags & XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL) {
+			s = XRP_STATUS_FAILURE;
+			break;
+		}
+	}
+	pthread_mutex_unlock(device->description->hw_mutex);
+	return s;
+}
+
+static enum xrp_status xrp_wait_request_events(struct xrp_request *rq)
+{
+	enum xrp_status s = XRP_STATUS_SUCCESS;
+	size_t i;
+
+	for (i = 0; i < rq->n_wait_events; ++i) {
+		struct xrp_event *event = rq->wait_event[i];
+
+		xrp_wait(event, NULL);
+		if (event->status != XRP_STATUS_SUCCESS)
+			s = XRP_STATUS_FAILURE;
+		xrp_release_event(event, NULL);
+	}
+	free(rq->wait_event);
+	return s;
+}
+
+static void xrp_stage_request_buffers(struct xrp_request *rq)
+{
+	struct xrp_buffer_group *buffer_group = rq->buffer_group;
+	size_t i;
+
+	if (!rq->n_buffers)
+		return;
+
+	if (!buffer_group->sealed)
+		pthread_mutex_lock(&buffer_group->mutex);
+	for (i = 0; i < rq->n_buffers; ++i) {
+		struct xrp_buffer *buffer = buffer_group->buffer[i].buffer;
+
+		if (buffer->type != XRP_BUFFER_TYPE_DEVICE)
+			memcpy(p2v(rq->user_buffer_allocation[i]->start),
+			       buffer->ptr, buffer->size);
+	}
+	if (!buffer_group->sealed)
+		pthread_mutex_unlock(&buffer_group->mutex);
+}
+
+/*
+ * Requests are staged in the shared memory by the thread that enqueues
+ * them. Each queue thread only hands its requests over to the DSP and
+ * copies the results back, so only the comm area access is serialized
+ * between the queues of a device, and it overlaps with staging and
+ * completion of requests on other queues.
+ */
+static int xrp_queue_process(struct xrp_queue *queue)
+{
+	struct xrp_device *device = queue->device;
 	struct xrp_request *rq;
 	size_t i;
 	int exit = 0;
+	int run;
 
-	device->sync_exit = &exit;
-	pthread_mutex_lock(&device->request_queue_mutex);
+	queue->sync_exit = &exit;
+	pthread_mutex_lock(&queue->request_queue_mutex);
 	for (;;) {
-		rq = _xrp_dequeue_request(device);
-		if (rq || device->exit)
+		rq = _xrp_dequeue_request(queue);
+		if (rq || queue->exit)
 			break;
-		pthread_cond_wait(&device->request_queue_cond,
-				  &device->request_queue_mutex);
+		pthread_cond_wait(&queue->request_queue_cond,
+				  &queue->request_queue_mutex);
 	}
-	pthread_mutex_unlock(&device->request_queue_mutex);
+	pthread_mutex_unlock(&queue->request_queue_mutex);
 
 	if (!rq)
 		return 0;
 
-	pthread_mutex_lock(&device->description->hw_mutex);
-	memcpy(dsp_cmd, &rq->dsp_cmd, sizeof(rq->dsp_cmd));
-	barrier();
-	xrp_comm_write32(&dsp_cmd->flags,
-			 rq->dsp_cmd.flags | XRP_DSP_CMD_FLAG_REQUEST_VALID);
-	barrier();
-	xrp_send_device_irq(device->description);
-	do {
-		barrier();
-	} while ((xrp_comm_read32(&dsp_cmd->flags) &
-		  (XRP_DSP_CMD_FLAG_REQUEST_VALID |
-		   XRP_DSP_CMD_FLAG_RESPONSE_VALID)) !=
-		 (XRP_DSP_CMD_FLAG_REQUEST_VALID |
-		  XRP_DSP_CMD_FLAG_RESPONSE_VALID));
-
-	memcpy(&rq->dsp_cmd, dsp_cmd, sizeof(rq->dsp_cmd));
-	VALGRIND_MAKE_MEM_DEFINED(rq->out_data_ptr, rq->out_data_size);
-	memcpy(rq->out_data, rq->out_data_ptr, rq->out_data_size);
-	pthread_mutex_unlock(&device->description->hw_mutex);
+	if (rq->command_list) {
+		enum xrp_status s = xrp_run_command_list(device,
+							 rq->command_list);
+
+		rq->command_list->queued = 0;
+		xrp_release_command_list(rq->command_list, NULL);
+		if (rq->event)
+			xrp_complete_event(rq->event, s);
+		free(rq);
+		return !exit;
+	}
+
+	/*
+	 * Commands that depend on failed commands are not run. Host buffers
+	 * of commands with dependencies are staged once the dependencies
+	 * are complete.
+	 */
+	run = xrp_wait_request_events(rq) == XRP_STATUS_SUCCESS;
+	if (run) {
+		if (rq->n_wait_events)
+			xrp_stage_request_buffers(rq);
+
+		xrp_hw_lock(device->description);
+		xrp_run_hw_command(device, &rq->dsp_cmd);
+		VALGRIND_MAKE_MEM_DEFINED(rq->out_data_ptr, rq->out_data_size);
+		memcpy(rq->out_data, rq->out_data_ptr, rq->out_data_size);
+		pthread_mutex_unlock(device->description->hw_mutex);
+	} else {
+		rq->dsp_cmd.flags |= XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL;
+	}
 
 	if (rq->in_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
-		xrp_free(rq->in_data_allocation);
+		xrp_pool_free(rq->in_data_allocation);
 	}
 	if (rq->out_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
-		xrp_free(rq->out_data_allocation);
+		xrp_pool_free(rq->out_data_allocation);
 	}
 
-	if (rq->buffer_group)
+	if (rq->buffer_group && !rq->buffer_group->sealed)
 		pthread_mutex_lock(&rq->buffer_group->mutex);
 
 	for (i = 0; i < rq->n_buffers; ++i) {
 		phys_addr_t addr;
 
 		if (rq->buffer_group->buffer[i].buffer->type != XRP_BUFFER_TYPE_DEVICE) {
-			if (rq->buffer_ptr[i].flags & XRP_DSP_BUFFER_FLAG_WRITE) {
+			if (run &&
+			    (rq->buffer_ptr[i].flags & XRP_DSP_BUFFER_FLAG_WRITE)) {
 				addr = rq->user_buffer_allocation[i]->start;
 				if (!(rq->buffer_ptr[i].flags & XRP_DSP_BUFFER_FLAG_READ))
 					VALGRIND_MAKE_MEM_DEFINED(p2v(addr),
@@ -1208,28 +1886,24 @@ static int xrp_queue_process(struct xrp_device *device)
 				memcpy(rq->buffer_group->buffer[i].buffer->ptr, p2v(addr),
 				       rq->buffer_group->buffer[i].buffer->size);
 			}
-			xrp_free(rq->user_buffer_allocation[i]);
+			xrp_pool_free(rq->user_buffer_allocation[i]);
 		}
 	}
 	if (rq->n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
-		xrp_free(rq->buffer_allocation);
+		xrp_pool_free(rq->buffer_allocation);
 	}
 
 	if (rq->buffer_group) {
-		pthread_mutex_unlock(&rq->buffer_group->mutex);
+		if (!rq->buffer_group->sealed)
+			pthread_mutex_unlock(&rq->buffer_group->mutex);
 		xrp_release_buffer_group(rq->buffer_group, NULL);
 	}
 
 	if (rq->event) {
-		struct xrp_event *event = rq->event;
-		pthread_mutex_lock(&event->mutex);
 		if (rq->dsp_cmd.flags & XRP_DSP_CMD_FLAG_RESPONSE_DELIVERY_FAIL)
-			event->status = XRP_STATUS_FAILURE;
+			xrp_complete_event(rq->event, XRP_STATUS_FAILURE);
 		else
-			event->status = XRP_STATUS_SUCCESS;
-		pthread_cond_broadcast(&event->cond);
-		pthread_mutex_unlock(&event->mutex);
-		xrp_release_event(event, NULL);
+			xrp_complete_event(rq->event, XRP_STATUS_SUCCESS);
 	}
 	free(rq->user_buffer_allocation);
 	free(rq);
@@ -1242,11 +1916,26 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 			 struct xrp_buffer_group *buffer_group,
 			 struct xrp_event **evt,
 			 enum xrp_status *status)
+{
+	xrp_enqueue_command_after(queue, in_data, in_data_size,
+				  out_data, out_data_size,
+				  buffer_group, NULL, 0, evt, status);
+}
+
+void xrp_enqueue_command_after(struct xrp_queue *queue,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       struct xrp_event *const *wait_event,
+			       size_t n_wait_events,
+			       struct xrp_event **evt,
+			       enum xrp_status *status)
 {
 	struct xrp_device *device = queue->device;
 	struct xrp_event *event = NULL;
 	size_t n_buffers;
 	size_t i;
+	int sealed = buffer_group && buffer_group->sealed;
 	struct xrp_request *rq = malloc(sizeof(*rq));
 	struct xrp_dsp_cmd *dsp_cmd = &rq->dsp_cmd;
 	void *in_data_ptr;
@@ -1254,12 +1943,30 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	rq->in_data_size = in_data_size;
 	rq->out_data = out_data;
 	rq->out_data_size = out_data_size;
+	if (!rq) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	rq->wait_event = malloc(n_wait_events * sizeof(*rq->wait_event));
+	if (n_wait_events && !rq->wait_event) {
+		free(rq);
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	for (i = 0; i < n_wait_events; ++i) {
+		xrp_retain_event(wait_event[i], NULL);
+		rq->wait_event[i] = wait_event[i];
+	}
+	rq->n_wait_events = n_wait_events;
+
 	rq->buffer_group = buffer_group;
+	rq->command_list = NULL;
+	rq->event = NULL;
 	if (buffer_group)
 		xrp_retain_buffer_group(buffer_group, NULL);
 
 	if (in_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
-		long rc = xrp_allocate(device->description->shared_pool,
+		long rc = xrp_pool_allocate(device->description->shared_pool,
 				       in_data_size,
 				       0x10, &rq->in_data_allocation);
 		if (rc < 0) {
@@ -1275,7 +1982,7 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	memcpy(in_data_ptr, in_data, in_data_size);
 
 	if (out_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
-		long rc = xrp_allocate(device->description->shared_pool,
+		long rc = xrp_pool_allocate(device->description->shared_pool,
 				       out_data_size,
 				       0x10, &rq->out_data_allocation);
 		if (rc < 0) {
@@ -1289,16 +1996,21 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	}
 	dsp_cmd->out_data_size = out_data_size;
 
-	if (buffer_group)
+	/*
+	 * Sealed group cannot change, no need to lock it or to check
+	 * whether its buffers are mapped.
+	 */
+	if (buffer_group && !sealed)
 		pthread_mutex_lock(&buffer_group->mutex);
 
 	n_buffers = buffer_group ? buffer_group->n_buffers : 0;
 	if (n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
-		long rc = xrp_allocate(device->description->shared_pool,
+		long rc = xrp_pool_allocate(device->description->shared_pool,
 				       n_buffers * sizeof(struct xrp_dsp_buffer),
 				       0x10, &rq->buffer_allocation);
 		if (rc < 0) {
-			pthread_mutex_unlock(&buffer_group->mutex);
+			if (!sealed)
+				pthread_mutex_unlock(&buffer_group->mutex);
 			set_status(status, XRP_STATUS_FAILURE);
 			return;
 		}
@@ -1311,58 +2023,74 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 
 	rq->n_buffers = n_buffers;
 	rq->user_buffer_allocation = malloc(n_buffers * sizeof(void *));
-	for (i = 0; i < n_buffers; ++i) {
-		phys_addr_t addr;
-
-		if (buffer_group->buffer[i].buffer->map_count > 0) {
-			pthread_mutex_unlock(&buffer_group->mutex);
-			set_status(status, XRP_STATUS_FAILURE);
-			return;
-
+	if (sealed) {
+		memcpy(rq->buffer_ptr, buffer_group->dsp_buffer,
+		       n_buffers * sizeof(struct xrp_dsp_buffer));
+		for (i = 0; i < n_buffers; ++i) {
+			struct xrp_buffer *buffer = buffer_group->buffer[i].buffer;
+			long rc;
+
+			if (buffer->type == XRP_BUFFER_TYPE_DEVICE)
+				continue;
+
+			rc = xrp_pool_allocate(device->description->shared_pool,
+					  buffer->size,
+					  0x10, rq->user_buffer_allocation + i);
+			if (rc < 0) {
+				set_status(status, XRP_STATUS_FAILURE);
+				return;
+			}
+			rq->buffer_ptr[i].addr = rq->user_buffer_allocation[i]->start;
+			if (!n_wait_events)
+				memcpy(p2v(rq->buffer_ptr[i].addr), buffer->ptr,
+				       buffer->size);
 		}
-		if (buffer_group->buffer[i].buffer->type == XRP_BUFFER_TYPE_DEVICE) {
-			addr = buffer_group->buffer[i].buffer->xrp_allocation->start;
-		} else {
-			long rc = xrp_allocate(device->description->shared_pool,
-					       buffer_group->buffer[i].buffer->size,
-					       0x10, rq->user_buffer_allocation + i);
+	} else {
+		for (i = 0; i < n_buffers; ++i) {
+			phys_addr_t addr;
 
-			if (rc < 0) {
+			if (buffer_group->buffer[i].buffer->map_count > 0) {
+				pthread_mutex_unlock(&buffer_group->mutex);
 				set_status(status, XRP_STATUS_FAILURE);
 				return;
+
 			}
-			addr = rq->user_buffer_allocation[i]->start;
-			memcpy(p2v(addr), buffer_group->buffer[i].buffer->ptr,
-			       buffer_group->buffer[i].buffer->size);
+			if (buffer_group->buffer[i].buffer->type == XRP_BUFFER_TYPE_DEVICE) {
+				addr = buffer_group->buffer[i].buffer->addr;
+			} else {
+				long rc = xrp_pool_allocate(device->description->shared_pool,
+						       buffer_group->buffer[i].buffer->size,
+						       0x10, rq->user_buffer_allocation + i);
+
+				if (rc < 0) {
+					set_status(status, XRP_STATUS_FAILURE);
+					return;
+				}
+				addr = rq->user_buffer_allocation[i]->start;
+				if (!n_wait_events)
+					memcpy(p2v(addr),
+					       buffer_group->buffer[i].buffer->ptr,
+					       buffer_group->buffer[i].buffer->size);
+			}
+			rq->buffer_ptr[i] = (struct xrp_dsp_buffer){
+				.flags = buffer_group->buffer[i].access_flags,
+				.size = buffer_group->buffer[i].buffer->size,
+				.addr = addr,
+			};
 		}
-		rq->buffer_ptr[i] = (struct xrp_dsp_buffer){
-			.flags = buffer_group->buffer[i].access_flags,
-			.size = buffer_group->buffer[i].buffer->size,
-			.addr = addr,
-		};
 	}
 
-	if (buffer_group)
+	if (buffer_group && !sealed)
 		pthread_mutex_unlock(&buffer_group->mutex);
 
 	if (evt) {
 		enum xrp_status s;
 
-		event = alloc_refcounted(sizeof(*event));
-		if (!event) {
-			set_status(status, XRP_STATUS_FAILURE);
-			return;
-		}
-		xrp_retain_device(queue->device, &s);
+		event = xrp_create_event(queue->device, &s);
 		if (s != XRP_STATUS_SUCCESS) {
 			set_status(status, s);
-			release_refcounted(event);
 			return;
 		}
-		event->device = queue->device;
-		pthread_mutex_init(&event->mutex, NULL);
-		pthread_cond_init(&event->cond, NULL);
-		event->status = XRP_STATUS_PENDING;
 		*evt = event;
 		xrp_retain_event(event, NULL);
 		rq->event = event;
@@ -1371,7 +2099,7 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 	if (queue->use_nsid) {
 		memcpy(dsp_cmd->nsid, queue->nsid, sizeof(dsp_cmd->nsid));
 	}
-	xrp_enqueue_request(device, rq);
+	xrp_enqueue_request(queue, rq);
 	set_status(status, XRP_STATUS_SUCCESS);
 }
 
@@ -1387,5 +2115,324 @@ void xrp_wait(struct xrp_event *event, enum xrp_status *status)
 void xrp_exit(void)
 {
 	void *exit_loc = p2v(xrp_exit_loc);
+	int i;
+
+	/*
+	 * The simulation is terminated by the last process using it.
+	 */
+	for (i = 0; i < xrp_device_count; ++i)
+		if (xrp_detach_device(xrp_device_description + i))
+			return;
 	xrp_comm_write32(exit_loc, 0xff);
 }
+
+
+/* Command list API. */
+
+struct xrp_command_list *xrp_create_command_list(struct xrp_queue *queue,
+						 enum xrp_status *status)
+{
+	struct xrp_command_list *list;
+	enum xrp_status s;
+
+	if (!queue) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	list = alloc_refcounted(sizeof(*list));
+	if (!list) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return NULL;
+	}
+
+	xrp_retain_queue(queue, &s);
+	if (s != XRP_STATUS_SUCCESS) {
+		set_status(status, s);
+		release_refcounted(list);
+		return NULL;
+	}
+	list->queue = queue;
+	pthread_mutex_init(&list->mutex, NULL);
+	set_status(status, XRP_STATUS_SUCCESS);
+	return list;
+}
+
+void xrp_retain_command_list(struct xrp_command_list *list,
+			     enum xrp_status *status)
+{
+	set_status(status, retain_refcounted(list));
+}
+
+static void xrp_free_command_list_record(struct xrp_command_list_record *command)
+{
+	size_t i;
+
+	if (command->in_data_allocation)
+		xrp_pool_free(command->in_data_allocation);
+	if (command->out_data_allocation)
+		xrp_pool_free(command->out_data_allocation);
+	if (command->buffer_allocation)
+		xrp_pool_free(command->buffer_allocation);
+	for (i = 0; i < command->n_buffers; ++i) {
+		if (command->buffer[i].allocation)
+			xrp_pool_free(command->buffer[i].allocation);
+		if (command->buffer[i].buffer)
+			xrp_release_buffer(command->buffer[i].buffer, NULL);
+	}
+	free(command->buffer);
+	free(command);
+}
+
+void xrp_release_command_list(struct xrp_command_list *list,
+			      enum xrp_status *status)
+{
+	if (last_refcount(list)) {
+		enum xrp_status s;
+		size_t i;
+
+		for (i = 0; i < list->n_commands; ++i)
+			xrp_free_command_list_record(list->command[i]);
+		free(list->command);
+		pthread_mutex_destroy(&list->mutex);
+		xrp_release_queue(list->queue, &s);
+		if (s != XRP_STATUS_SUCCESS) {
+			set_status(status, s);
+			return;
+		}
+	}
+	set_status(status, release_refcounted(list));
+}
+
+static struct xrp_command_list_record *
+xrp_create_command_list_record(struct xrp_queue *queue,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group)
+{
+	struct xrp_allocation_pool *pool = queue->device->description->shared_pool;
+	struct xrp_command_list_record *command = calloc(1, sizeof(*command));
+	struct xrp_dsp_cmd *dsp_cmd;
+	struct xrp_dsp_buffer *buffer_ptr;
+	size_t n_buffers;
+	size_t i;
+
+	if (!command)
+		return NULL;
+
+	dsp_cmd = &command->dsp_cmd;
+	command->out_data = out_data;
+
+	if (in_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
+		if (xrp_pool_allocate(pool, in_data_size, 0x10,
+				 &command->in_data_allocation) < 0)
+			goto err;
+		dsp_cmd->in_data_addr = command->in_data_allocation->start;
+		memcpy(p2v(dsp_cmd->in_data_addr), in_data, in_data_size);
+	} else {
+		memcpy(&dsp_cmd->in_data, in_data, in_data_size);
+	}
+	dsp_cmd->in_data_size = in_data_size;
+
+	if (out_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE) {
+		if (xrp_pool_allocate(pool, out_data_size, 0x10,
+				 &command->out_data_allocation) < 0)
+			goto err;
+		dsp_cmd->out_data_addr = command->out_data_allocation->start;
+	}
+	dsp_cmd->out_data_size = out_data_size;
+
+	if (!buffer_group)
+		goto done;
+
+	pthread_mutex_lock(&buffer_group->mutex);
+	n_buffers = buffer_group->n_buffers;
+	command->buffer = calloc(n_buffers, sizeof(*command->buffer));
+	if (n_buffers && !command->buffer) {
+		pthread_mutex_unlock(&buffer_group->mutex);
+		goto err;
+	}
+	command->n_buffers = n_buffers;
+	for (i = 0; i < n_buffers; ++i) {
+		command->buffer[i].buffer = buffer_group->buffer[i].buffer;
+		command->buffer[i].access_flags =
+			buffer_group->buffer[i].access_flags;
+		xrp_retain_buffer(command->buffer[i].buffer, NULL);
+	}
+	pthread_mutex_unlock(&buffer_group->mutex);
+
+	if (n_buffers > XRP_DSP_CMD_INLINE_BUFFER_COUNT) {
+		if (xrp_pool_allocate(pool,
+				 n_buffers * sizeof(struct xrp_dsp_buffer),
+				 0x10, &command->buffer_allocation) < 0)
+			goto err;
+		dsp_cmd->buffer_addr = command->buffer_allocation->start;
+		buffer_ptr = p2v(dsp_cmd->buffer_addr);
+	} else {
+		buffer_ptr = dsp_cmd->buffer_data;
+	}
+	dsp_cmd->buffer_size = n_buffers * sizeof(struct xrp_dsp_buffer);
+
+	for (i = 0; i < n_buffers; ++i) {
+		struct xrp_buffer *buffer = command->buffer[i].buffer;
+		phys_addr_t addr;
+
+		if (buffer->type == XRP_BUFFER_TYPE_DEVICE) {
+			addr = buffer->addr;
+		} else {
+			if (xrp_pool_allocate(pool, buffer->size, 0x10,
+					 &command->buffer[i].allocation) < 0)
+				goto err;
+			addr = command->buffer[i].allocation->start;
+		}
+		buffer_ptr[i] = (struct xrp_dsp_buffer){
+			.flags = command->buffer[i].access_flags,
+			.size = buffer->size,
+			.addr = addr,
+		};
+	}
+done:
+	dsp_cmd->flags = (queue->use_nsid ? XRP_DSP_CMD_FLAG_REQUEST_NSID : 0);
+	if (queue->use_nsid) {
+		memcpy(dsp_cmd->nsid, queue->nsid, sizeof(dsp_cmd->nsid));
+	}
+	return command;
+err:
+	xrp_free_command_list_record(command);
+	return NULL;
+}
+
+size_t xrp_add_command_to_list(struct xrp_command_list *list,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       enum xrp_status *status)
+{
+	struct xrp_command_list_record *command;
+	size_t idx;
+
+	command = xrp_create_command_list_record(list->queue,
+						 in_data, in_data_size,
+						 out_data, out_data_size,
+						 buffer_group);
+	if (!command) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
+
+	pthread_mutex_lock(&list->mutex);
+	if (!list->queued && list->n_commands == list->capacity) {
+		struct xrp_command_list_record **r =
+			realloc(list->command,
+				sizeof(*r) * ((list->capacity + 2) * 2));
+
+		if (r) {
+			list->command = r;
+			list->capacity = (list->capacity + 2) * 2;
+		}
+	}
+	if (list->queued || list->n_commands == list->capacity) {
+		pthread_mutex_unlock(&list->mutex);
+		xrp_free_command_list_record(command);
+		set_status(status, XRP_STATUS_FAILURE);
+		return -1;
+	}
+	idx = list->n_commands++;
+	list->command[idx] = command;
+	pthread_mutex_unlock(&list->mutex);
+	set_status(status, XRP_STATUS_SUCCESS);
+	return idx;
+}
+
+void xrp_set_command_in_data(struct xrp_command_list *list,
+			     size_t index, size_t offset,
+			     const void *data, size_t size,
+			     enum xrp_status *status)
+{
+	enum xrp_status s = XRP_STATUS_FAILURE;
+
+	pthread_mutex_lock(&list->mutex);
+	if (!list->queued && index < list->n_commands) {
+		struct xrp_dsp_cmd *dsp_cmd = &list->command[index]->dsp_cmd;
+		size_t in_data_size = dsp_cmd->in_data_size;
+
+		if (offset <= in_data_size && size <= in_data_size - offset) {
+			void *in_data_ptr;
+
+			if (in_data_size > XRP_DSP_CMD_INLINE_DATA_SIZE)
+				in_data_ptr = p2v(dsp_cmd->in_data_addr);
+			else
+				in_data_ptr = &dsp_cmd->in_data;
+			memcpy((char *)in_data_ptr + offset, data, size);
+			s = XRP_STATUS_SUCCESS;
+		}
+	}
+	pthread_mutex_unlock(&list->mutex);
+	set_status(status, s);
+}
+
+void xrp_enqueue_command_list(struct xrp_command_list *list,
+			      struct xrp_event **evt,
+			      enum xrp_status *status)
+{
+	struct xrp_device *device = list->queue->device;
+	struct xrp_request *rq;
+	struct xrp_event *event = NULL;
+	enum xrp_status s;
+	size_t i, j;
+
+	rq = calloc(1, sizeof(*rq));
+	if (!rq) {
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+
+	if (evt) {
+		event = xrp_create_event(device, &s);
+		if (s != XRP_STATUS_SUCCESS) {
+			free(rq);
+			set_status(status, s);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&list->mutex);
+	if (list->queued) {
+		pthread_mutex_unlock(&list->mutex);
+		if (event)
+			xrp_release_event(event, NULL);
+		free(rq);
+		set_status(status, XRP_STATUS_FAILURE);
+		return;
+	}
+	list->queued = 1;
+	pthread_mutex_unlock(&list->mutex);
+
+	/*
+	 * Everything but host buffer contents is already in place in the
+	 * shared memory.
+	 */
+	for (i = 0; i < list->n_commands; ++i) {
+		struct xrp_command_list_record *command = list->command[i];
+
+		for (j = 0; j < command->n_buffers; ++j) {
+			struct xrp_command_list_buffer *buffer =
+				command->buffer + j;
+
+			if (buffer->allocation)
+				memcpy(p2v(buffer->allocation->start),
+				       buffer->buffer->ptr,
+				       buffer->buffer->size);
+		}
+	}
+
+	xrp_retain_command_list(list, NULL);
+	rq->command_list = list;
+	if (event) {
+		*evt = event;
+		xrp_retain_event(event, NULL);
+		rq->event = event;
+	}
+	xrp_enqueue_request(list->queue, rq);
+	set_status(status, XRP_STATUS_SUCCESS);
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Thread caches for the shared memory pools of the simulation library.
+ *
+ * The private allocator keeps a single locked free list per pool. Staging
+ * memory is allocated by application threads and freed by queue threads
+ * for every command, so allocations of the common sizes are cached in
+ * small per-thread magazines of fixed size classes in front of it. A
+ * magazine that runs empty is refilled with half of its capacity from the
+ * pool, a full magazine gives half of its objects back.
+ *
+ * All thread caches are registered globally. When the pool runs out of
+ * memory the objects held in the caches of all threads are given back to
+ * it and the allocation is retried.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xrp_pool_cache.h"
+
+#define XRP_POOL_CACHE_MIN_SHIFT	12
+#define XRP_POOL_CACHE_MAX_SHIFT	16
+#define XRP_POOL_CACHE_N_CLASSES	(XRP_POOL_CACHE_MAX_SHIFT - \
+					 XRP_POOL_CACHE_MIN_SHIFT + 1)
+#define XRP_POOL_CACHE_SIZE		8
+
+struct xrp_pool_cache {
+	/* caches of the same thread */
+	struct xrp_pool_cache *next;
+	/* caches of all threads */
+	struct xrp_pool_cache *global_next;
+	struct xrp_pool_cache **global_pprev;
+
+	struct xrp_allocation_pool *pool;
+	pthread_mutex_t mutex;
+	unsigned n[XRP_POOL_CACHE_N_CLASSES];
+	struct xrp_allocation *allocation[XRP_POOL_CACHE_N_CLASSES]
+		[XRP_POOL_CACHE_SIZE];
+};
+
+static pthread_mutex_t xrp_pool_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct xrp_pool_cache *xrp_pool_caches;
+static pthread_once_t xrp_pool_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t xrp_pool_cache_key;
+static __thread struct xrp_pool_cache *xrp_pool_thread_cache;
+
+/*
+ * Size class of the allocation size, -1 if it's not cached.
+ */
+static inline int xrp_pool_cache_class(u32 size)
+{
+	int cls;
+
+	for (cls = 0; cls < XRP_POOL_CACHE_N_CLASSES; ++cls)
+		if (size <= (1u << (cls + XRP_POOL_CACHE_MIN_SHIFT)))
+			return cls;
+	return -1;
+}
+
+static void xrp_pool_cache_put(struct xrp_allocation **allocation,
+			       unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		xrp_free(allocation[i]);
+}
+
+/*
+ * Give all objects held by the cache back to the pool.
+ * Called with the global cache mutex held.
+ */
+static void xrp_pool_cache_drain(struct xrp_pool_cache *cache)
+{
+	struct xrp_allocation *allocation[XRP_POOL_CACHE_SIZE];
+	unsigned cls;
+
+	for (cls = 0; cls < XRP_POOL_CACHE_N_CLASSES; ++cls) {
+		unsigned n;
+
+		pthread_mutex_lock(&cache->mutex);
+		n = cache->n[cls];
+		cache->n[cls] = 0;
+		memcpy(allocation, cache->allocation[cls],
+		       n * sizeof(*allocation));
+		pthread_mutex_unlock(&cache->mutex);
+		xrp_pool_cache_put(allocation, n);
+	}
+}
+
+static void xrp_pool_cache_reclaim(struct xrp_allocation_pool *pool)
+{
+	struct xrp_pool_cache *cache;
+
+	pthread_mutex_lock(&xrp_pool_cache_mutex);
+	for (cache = xrp_pool_caches; cache; cache = cache->global_next)
+		if (cache->pool == pool)
+			xrp_pool_cache_drain(cache);
+	pthread_mutex_unlock(&xrp_pool_cache_mutex);
+}
+
+static void xrp_pool_thread_exit(void *p)
+{
+	struct xrp_pool_cache *cache = p;
+
+	pthread_mutex_lock(&xrp_pool_cache_mutex);
+	while (cache) {
+		struct xrp_pool_cache *next = cache->next;
+
+		xrp_pool_cache_drain(cache);
+		*cache->global_pprev = cache->global_next;
+		if (cache->global_next)
+			cache->global_next->global_pprev = cache->global_pprev;
+		pthread_mutex_destroy(&cache->mutex);
+		free(cache);
+		cache = next;
+	}
+	pthread_mutex_unlock(&xrp_pool_cache_mutex);
+	xrp_pool_thread_cache = NULL;
+}
+
+/*
+ * Pools may outlive the process, give back objects cached by the threads
+ * that are still running at exit.
+ */
+static void xrp_pool_process_exit(void)
+{
+	struct xrp_pool_cache *cache;
+
+	pthread_mutex_lock(&xrp_pool_cache_mutex);
+	for (cache = xrp_pool_caches; cache; cache = cache->global_next)
+		xrp_pool_cache_drain(cache);
+	pthread_mutex_unlock(&xrp_pool_cache_mutex);
+}
+
+static void xrp_pool_init_key(void)
+{
+	pthread_key_create(&xrp_pool_cache_key, xrp_pool_thread_exit);
+	atexit(xrp_pool_process_exit);
+}
+
+static struct xrp_pool_cache *
+xrp_pool_get_cache(struct xrp_allocation_pool *pool)
+{
+	struct xrp_pool_cache *cache;
+
+	for (cache = xrp_pool_thread_cache; cache; cache = cache->next)
+		if (cache->pool == pool)
+			return cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	pthread_once(&xrp_pool_cache_once, xrp_pool_init_key);
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->pool = pool;
+
+	pthread_mutex_lock(&xrp_pool_cache_mutex);
+	cache->global_next = xrp_pool_caches;
+	if (xrp_pool_caches)
+		xrp_pool_caches->global_pprev = &cache->global_next;
+	cache->global_pprev = &xrp_pool_caches;
+	xrp_pool_caches = cache;
+	pthread_mutex_unlock(&xrp_pool_cache_mutex);
+
+	cache->next = xrp_pool_thread_cache;
+	xrp_pool_thread_cache = cache;
+	pthread_setspecific(xrp_pool_cache_key, cache);
+	return cache;
+}
+
+static long xrp_pool_refill(struct xrp_pool_cache *cache, int cls,
+			    struct xrp_allocation **alloc)
+{
+	u32 size = 1u << (cls + XRP_POOL_CACHE_MIN_SHIFT);
+	struct xrp_allocation *allocation[XRP_POOL_CACHE_SIZE / 2];
+	unsigned n;
+	long rc;
+
+	rc = xrp_allocate(cache->pool, size, 0, alloc);
+	if (rc < 0)
+		return rc;
+
+	for (n = 0; n < XRP_POOL_CACHE_SIZE / 2; ++n)
+		if (xrp_allocate(cache->pool, size, 0, allocation + n) < 0)
+			break;
+
+	pthread_mutex_lock(&cache->mutex);
+	while (n && cache->n[cls] < XRP_POOL_CACHE_SIZE)
+		cache->allocation[cls][cache->n[cls]++] = allocation[--n];
+	pthread_mutex_unlock(&cache->mutex);
+	xrp_pool_cache_put(allocation, n);
+	return 0;
+}
+
+long xrp_pool_allocate(struct xrp_allocation_pool *pool,
+		       u32 size, u32 align,
+		       struct xrp_allocation **alloc)
+{
+	int cls = xrp_pool_cache_class(size);
+	struct xrp_pool_cache *cache;
+	long rc;
+
+	/*
+	 * The private allocator works with whole pages, page-aligned
+	 * allocations of the class size fit any smaller alignment.
+	 */
+	if (size && cls >= 0 &&
+	    align <= (1u << XRP_POOL_CACHE_MIN_SHIFT) &&
+	    (cache = xrp_pool_get_cache(pool))) {
+		pthread_mutex_lock(&cache->mutex);
+		if (cache->n[cls]) {
+			*alloc = cache->allocation[cls][--cache->n[cls]];
+			pthread_mutex_unlock(&cache->mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&cache->mutex);
+
+		rc = xrp_pool_refill(cache, cls, alloc);
+		if (rc >= 0)
+			return rc;
+		xrp_pool_cache_reclaim(pool);
+		return xrp_pool_refill(cache, cls, alloc);
+	}
+
+	rc = xrp_allocate(pool, size, align, alloc);
+	if (rc < 0) {
+		xrp_pool_cache_reclaim(pool);
+		rc = xrp_allocate(pool, size, align, alloc);
+	}
+	return rc;
+}
+
+void xrp_pool_free(struct xrp_allocation *allocation)
+{
+	int cls = xrp_pool_cache_class(allocation->size);
+	struct xrp_allocation *put[XRP_POOL_CACHE_SIZE / 2];
+	struct xrp_pool_cache *cache;
+	unsigned n = 0;
+
+	if (cls < 0 ||
+	    allocation->size != (1u << (cls + XRP_POOL_CACHE_MIN_SHIFT)) ||
+	    !(cache = xrp_pool_get_cache(allocation->pool))) {
+		xrp_free(allocation);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	if (cache->n[cls] == XRP_POOL_CACHE_SIZE) {
+		for (n = 0; n < XRP_POOL_CACHE_SIZE / 2; ++n)
+			put[n] = cache->allocation[cls][--cache->n[cls]];
+	}
+	cache->allocation[cls][cache->n[cls]++] = allocation;
+	pthread_mutex_unlock(&cache->mutex);
+	xrp_pool_cache_put(put, n);
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Allocation pool with its state in memory shared between processes.
+ *
+ * Pool memory is managed in pages, the state is a bitmap of allocated
+ * pages guarded by a process-shared robust mutex. Allocation objects
+ * only describe allocated ranges, they are private to the process that
+ * made the allocation.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xrp_shared_pool.h"
+
+#define XRP_SHARED_POOL_PAGE_SHIFT	12
+#define XRP_SHARED_POOL_PAGE_SIZE	(1u << XRP_SHARED_POOL_PAGE_SHIFT)
+#define XRP_SHARED_POOL_NONE		((uint32_t)-1)
+
+#define container_of(ptr, type, member) ({				\
+	void *__mptr = (void *)(ptr);					\
+	((type *)(__mptr - offsetof(type, member))); })
+
+struct xrp_shared_pool_state {
+	pthread_mutex_t mutex;
+	uint32_t n_pages;
+	/* page to start searching from */
+	uint32_t hint;
+	uint32_t bitmap[];
+};
+
+struct xrp_shared_pool {
+	struct xrp_allocation_pool pool;
+	struct xrp_shared_pool_state *state;
+	phys_addr_t start;
+	u32 size;
+};
+
+static inline int xrp_page_used(const struct xrp_shared_pool_state *state,
+				uint32_t page)
+{
+	return (state->bitmap[page / 32] >> (page % 32)) & 1;
+}
+
+static void xrp_mark_pages(struct xrp_shared_pool_state *state,
+			   uint32_t page, uint32_t n, int used)
+{
+	for (; n; ++page, --n) {
+		if (used)
+			state->bitmap[page / 32] |= 1u << (page % 32);
+		else
+			state->bitmap[page / 32] &= ~(1u << (page % 32));
+	}
+}
+
+/*
+ * Find n free pages aligned to align pages in [from, to).
+ */
+static uint32_t xrp_find_pages(const struct xrp_shared_pool_state *state,
+			       uint32_t from, uint32_t to,
+			       uint32_t n, uint32_t align)
+{
+	uint32_t page = (from + align - 1) & -align;
+
+	while (page < to && to - page >= n) {
+		uint32_t i;
+
+		if (state->bitmap[page / 32] == 0xffffffff) {
+			page = ((page / 32 + 1) * 32 + align - 1) & -align;
+			continue;
+		}
+		for (i = 0; i < n; ++i)
+			if (xrp_page_used(state, page + i))
+				break;
+		if (i == n)
+			return page;
+		page = (page + i + align) & -align;
+	}
+	return XRP_SHARED_POOL_NONE;
+}
+
+/*
+ * The mutex is robust: if its previous owner died the bitmap may have
+ * been partially updated, which leaks at most the pages of one
+ * allocation.
+ */
+static void xrp_shared_pool_lock(struct xrp_shared_pool_state *state)
+{
+	if (pthread_mutex_lock(&state->mutex) == EOWNERDEAD)
+		pthread_mutex_consistent(&state->mutex);
+}
+
+static void xrp_shared_pool_unlock(struct xrp_shared_pool_state *state)
+{
+	pthread_mutex_unlock(&state->mutex);
+}
+
+static long xrp_shared_pool_alloc(struct xrp_allocation_pool *pool,
+				  u32 size, u32 align,
+				  struct xrp_allocation **alloc)
+{
+	struct xrp_shared_pool *spool = container_of(pool,
+						     struct xrp_shared_pool,
+						     pool);
+	struct xrp_shared_pool_state *state = spool->state;
+	struct xrp_allocation *allocation;
+	uint32_t n, page;
+
+	if (!size || (align & (align - 1)))
+		return -EINVAL;
+
+	n = (size + XRP_SHARED_POOL_PAGE_SIZE - 1) >> XRP_SHARED_POOL_PAGE_SHIFT;
+	align >>= XRP_SHARED_POOL_PAGE_SHIFT;
+	if (!align)
+		align = 1;
+
+	allocation = calloc(1, sizeof(*allocation));
+	if (!allocation)
+		return -ENOMEM;
+
+	xrp_shared_pool_lock(state);
+	page = xrp_find_pages(state, state->hint, state->n_pages, n, align);
+	if (page == XRP_SHARED_POOL_NONE)
+		page = xrp_find_pages(state, 0, state->n_pages, n, align);
+	if (page != XRP_SHARED_POOL_NONE) {
+		xrp_mark_pages(state, page, n, 1);
+		state->hint = page + n;
+	}
+	xrp_shared_pool_unlock(state);
+
+	if (page == XRP_SHARED_POOL_NONE) {
+		free(allocation);
+		return -ENOMEM;
+	}
+
+	allocation->pool = pool;
+	allocation->start = spool->start +
+		(page << XRP_SHARED_POOL_PAGE_SHIFT);
+	allocation->size = n << XRP_SHARED_POOL_PAGE_SHIFT;
+	allocation->ref = 1;
+	*alloc = allocation;
+	return 0;
+}
+
+static void xrp_shared_pool_free(struct xrp_allocation *allocation)
+{
+	struct xrp_shared_pool *spool = container_of(allocation->pool,
+						     struct xrp_shared_pool,
+						     pool);
+	struct xrp_shared_pool_state *state = spool->state;
+	uint32_t page = (allocation->start - spool->start) >>
+		XRP_SHARED_POOL_PAGE_SHIFT;
+
+	xrp_shared_pool_lock(state);
+	xrp_mark_pages(state, page,
+		       allocation->size >> XRP_SHARED_POOL_PAGE_SHIFT, 0);
+	if (page < state->hint)
+		state->hint = page;
+	xrp_shared_pool_unlock(state);
+	free(allocation);
+}
+
+static void xrp_shared_pool_free_pool(struct xrp_allocation_pool *pool)
+{
+	free(container_of(pool, struct xrp_shared_pool, pool));
+}
+
+static phys_addr_t xrp_shared_pool_offset(const struct xrp_allocation *allocation)
+{
+	const struct xrp_shared_pool *spool =
+		container_of(allocation->pool, struct xrp_shared_pool, pool);
+
+	return allocation->start - spool->start;
+}
+
+static const struct xrp_allocation_ops xrp_shared_pool_ops = {
+	.alloc = xrp_shared_pool_alloc,
+	.free = xrp_shared_pool_free,
+	.free_pool = xrp_shared_pool_free_pool,
+	.offset = xrp_shared_pool_offset,
+};
+
+size_t xrp_shared_pool_state_size(u32 size)
+{
+	uint32_t n_pages = size >> XRP_SHARED_POOL_PAGE_SHIFT;
+
+	return sizeof(struct xrp_shared_pool_state) +
+		(n_pages + 31) / 32 * sizeof(uint32_t);
+}
+
+void xrp_shared_pool_init_state(void *p, u32 size)
+{
+	struct xrp_shared_pool_state *state = p;
+	pthread_mutexattr_t attr;
+
+	memset(state, 0, xrp_shared_pool_state_size(size));
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&state->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	state->n_pages = size >> XRP_SHARED_POOL_PAGE_SHIFT;
+}
+
+long xrp_init_shared_pool(struct xrp_allocation_pool **pool,
+			  void *state, phys_addr_t start, u32 size)
+{
+	struct xrp_shared_pool *spool = malloc(sizeof(*spool));
+
+	if (!spool)
+		return -ENOMEM;
+
+	*spool = (struct xrp_shared_pool){
+		.pool = {
+			.ops = &xrp_shared_pool_ops,
+		},
+		.state = state,
+		.start = start,
+		.size = size,
+	};
+	*pool = &spool->pool;
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2018 Cadence Design Systems Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XRP_SHARED_POOL_H
+#define XRP_SHARED_POOL_H
+
+#include <stddef.h>
+#include "xrp_alloc.h"
+
+/*
+ * Size of the state of a shared pool of up to size bytes.
+ */
+size_t xrp_shared_pool_state_size(u32 size);
+
+/*
+ * Initialize state of a shared pool of size bytes at state, with all pool
+ * memory free. The state may be placed in memory shared between
+ * processes, it must not be in use by any process.
+ */
+void xrp_shared_pool_init_state(void *state, u32 size);
+
+/*
+ * Create process-local pool object for the pool with state at state
+ * managing size bytes at the physical address start.
+ */
+long xrp_init_shared_pool(struct xrp_allocation_pool **pool,
+			  void *state, phys_addr_t start, u32 size);
+
+#endif
@@ -39,6 +39,8 @@ struct xrp_queue;
 struct xrp_buffer;
 struct xrp_buffer_group;
 struct xrp_event;
+struct xrp_command_list;
+struct xrp_command_token;
 
 enum xrp_status {
 	XRP_STATUS_SUCCESS,
@@ -114,6 +116,19 @@ struct xrp_buffer *xrp_create_buffer(struct xrp_device *device,
 				     size_t size, void *host_ptr,
 				     enum xrp_status *status);
 
+/*
+ * Create buffer that aliases size bytes of the parent buffer starting at
+ * offset. No new storage is allocated, the sub-buffer keeps a reference to
+ * the parent and is passed to the DSP as the corresponding range of the
+ * parent storage. Mapping state of the sub-buffer and its parent is
+ * tracked separately: neither of them may be mapped when a command that
+ * uses the other is queued.
+ * A buffer is reference counted and is created with reference count of 1.
+ */
+struct xrp_buffer *xrp_create_sub_buffer(struct xrp_buffer *parent,
+					 size_t offset, size_t size,
+					 enum xrp_status *status);
+
 /*
  * Increment buffer reference count.
  */
@@ -151,6 +166,27 @@ void xrp_buffer_get_info(struct xrp_buffer *buffer, enum xrp_buffer_info info,
 			 void *out, size_t out_sz, enum xrp_status *status);
 
 
+/*
+ * Host memory API.
+ * Available on the host side only.
+ */
+
+/*
+ * Allocate size bytes of host memory that the device can access directly.
+ * Buffers created with xrp_create_buffer on such memory are passed to the
+ * DSP by address, their contents are not copied when commands are run.
+ */
+void *xrp_host_alloc(struct xrp_device *device, size_t size,
+		     enum xrp_status *status);
+
+/*
+ * Free memory allocated with xrp_host_alloc. No buffer created on that
+ * memory may be in use.
+ */
+void xrp_host_free(struct xrp_device *device, void *p,
+		   enum xrp_status *status);
+
+
 /*
  * Buffer group API.
  * Available on both host and DSP side.
@@ -222,6 +258,20 @@ void xrp_buffer_group_get_info(struct xrp_buffer_group *group,
 			       void *out, size_t out_sz,
 			       enum xrp_status *status);
 
+/*
+ * Seal the buffer group.
+ * Sealed group cannot be modified: xrp_add_buffer_to_group and
+ * xrp_set_buffer_in_group fail on it. In exchange the implementation
+ * validates the group and prepares its buffer descriptors once, so that
+ * commands using the group don't need to lock it or rebuild descriptors.
+ * It is the caller's responsibility to keep buffers of a sealed group
+ * unmapped while commands that use it are queued, this is not checked.
+ * Sealing already sealed group succeeds and does nothing.
+ * Buffer groups passed to the DSP side are always treated as sealed.
+ */
+void xrp_seal_buffer_group(struct xrp_buffer_group *group,
+			   enum xrp_status *status);
+
 
 /*
  * Queue API.
@@ -358,6 +408,24 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 			 struct xrp_event **event,
 			 enum xrp_status *status);
 
+/*
+ * Queue a command like xrp_enqueue_command does, but don't start it until
+ * all n_wait_events events in the wait_event array are signaled. Events
+ * may belong to other queues or devices. Dependencies are resolved by the
+ * implementation, the caller does not need to wait for them.
+ *
+ * If any of the events is signaled with failure status the command is not
+ * executed and its own event is signaled with failure status.
+ */
+void xrp_enqueue_command_after(struct xrp_queue *queue,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       struct xrp_event *const *wait_event,
+			       size_t n_wait_events,
+			       struct xrp_event **event,
+			       enum xrp_status *status);
+
 /*
  * Wait for the event.
  * Waiting for already signaled event completes immediately.
@@ -369,6 +437,80 @@ void xrp_enqueue_command(struct xrp_queue *queue,
 void xrp_wait(struct xrp_event *event, enum xrp_status *status);
 
 
+/*
+ * Command list API. Available on the host side only.
+ */
+
+/*
+ * Create an empty command list for the queue.
+ * Command list is a recorded sequence of commands that can be submitted
+ * to the queue repeatedly with a single call. Validation, allocation and
+ * buffer descriptor setup is done when commands are added to the list,
+ * not when the list is submitted. Command list is reference counted and
+ * is created with reference count of 1.
+ */
+struct xrp_command_list *xrp_create_command_list(struct xrp_queue *queue,
+						 enum xrp_status *status);
+
+/*
+ * Increment command list reference count.
+ */
+void xrp_retain_command_list(struct xrp_command_list *list,
+			     enum xrp_status *status);
+
+/*
+ * Decrement command list reference count (and free it once the counter gets
+ * down to zero).
+ */
+void xrp_release_command_list(struct xrp_command_list *list,
+			      enum xrp_status *status);
+
+/*
+ * Append a command to the command list.
+ * Parameters have the same meaning as for xrp_enqueue_command, except that:
+ * - in_data is copied into the list and may later be changed with
+ *   xrp_set_command_in_data;
+ * - out_data must stay valid for the lifetime of the list, it is updated
+ *   every time the list is executed;
+ * - the set of buffers in the buffer group is captured at this point,
+ *   changes made to the group afterwards don't affect the list.
+ *
+ * Returns index of the command in the list.
+ */
+size_t xrp_add_command_to_list(struct xrp_command_list *list,
+			       const void *in_data, size_t in_data_size,
+			       void *out_data, size_t out_data_size,
+			       struct xrp_buffer_group *buffer_group,
+			       enum xrp_status *status);
+
+/*
+ * Patch in_data of the command at the given index of the list.
+ * size bytes from data are copied to the recorded in_data at the offset.
+ * The list must not be queued at that point.
+ */
+void xrp_set_command_in_data(struct xrp_command_list *list,
+			     size_t index, size_t offset,
+			     const void *data, size_t size,
+			     enum xrp_status *status);
+
+/*
+ * Queue all commands of the list to the list queue, in order.
+ * All buffers used by the list must be unmapped at that point.
+ * The list may not be queued again until the previous submission is
+ * complete. Execution stops at the first failed command.
+ *
+ * If event is non-NULL then a pointer to an event corresponding to the
+ * whole list is returned. It is signaled when all commands are complete,
+ * or when execution stops because of a failure. Its status is success
+ * only if all commands were executed successfully.
+ *
+ * status is the result of list enqueuing, see xrp_enqueue_command.
+ */
+void xrp_enqueue_command_list(struct xrp_command_list *list,
+			      struct xrp_event **event,
+			      enum xrp_status *status);
+
+
 /* New DSP-specific interface (library-style) */
 
 /*
@@ -384,7 +526,9 @@ enum xrp_status xrp_device_poll(struct xrp_device *device);
  * Check if there's a command from the host in the hardware queue and invoke
  * command handler if there's one.
  * Returns XRP_STATUS_PENDING if the queue is empty, or the status returned by
- * the command handler.
+ * the command handler. Command which completion was deferred by the handler
+ * is reported as XRP_STATUS_SUCCESS, no new command is dispatched until it
+ * is completed.
  */
 enum xrp_status xrp_device_dispatch(struct xrp_device *device);
 
@@ -408,6 +552,10 @@ enum xrp_status xrp_device_dispatch(struct xrp_device *device);
  * If the command was run that's XRP_STATUS_SUCCESS regardless of the
  * command-specific status, which should be returned in out_data.
  *
+ * A handler that only starts the command may call xrp_defer_command and
+ * return XRP_STATUS_PENDING. The rules above then apply to the
+ * xrp_complete_command call instead of the return from the handler.
+ *
  * \param handler_context: context that was passed to the
  *                         xrp_device_register_namespace
  */
@@ -450,6 +598,33 @@ void xrp_device_unregister_namespace(struct xrp_device *device,
 				     enum xrp_status *status);
 
 
+/*
+ * Defer completion of the command being processed.
+ *
+ * May only be called from a command handler, which shall then return
+ * XRP_STATUS_PENDING. in_data, out_data and the buffer group of the command
+ * stay valid until the command is completed with xrp_complete_command.
+ *
+ * Returns the token that identifies the command in xrp_complete_command.
+ */
+struct xrp_command_token *xrp_defer_command(enum xrp_status *status);
+
+/*
+ * Complete the command which completion was deferred.
+ *
+ * Must not be called from an interrupt handler or from the handler of the
+ * command being completed.
+ *
+ * \param token: token returned by xrp_defer_command
+ * \param command_status: status delivered to the host, the same as the
+ *                        handler return value for non-deferred commands
+ * \param status: status of the operation
+ */
+void xrp_complete_command(struct xrp_command_token *token,
+			  enum xrp_status command_status,
+			  enum xrp_status *status);
+
+
 /* Legacy DSP-specific interface (framework-style) */
 
 /*